@@ -0,0 +1,480 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "tree.h"
+
+/*
+    Benchmarks of tree operations. Every operation is measured on trees of every
+    shape, size and payload size (see SHAPES, SIZES and PAYLOADS), results are
+    written to stdout as CSV:
+
+    op,shape,nodes,payload,alloc,ns_total,ns_per_node
+
+    'alloc' is "pool" for trees of the library and "calloc" for the baseline:
+    nodes of the same layout, allocated by calloc() one by one.
+    Every measurement is repeated (small trees more times), the best time is taken.
+
+    Usage: bench [max_nodes] [mem_limit_mb]
+    Combinations, which need more than 'mem_limit_mb' of memory, are skipped.
+*/
+
+enum BenchShape
+{
+    BENCH_SHAPE_BALANCED,
+    BENCH_SHAPE_RANDOM,
+    BENCH_SHAPE_CHAIN,
+};
+
+const char * const SHAPES[]     = { "balanced", "random", "chain" };
+const size_t SIZES[]            = { 1000, 10000, 100000, 1000000, 10000000 };
+const size_t PAYLOADS[]         = { 8, 64, 256 };
+
+const size_t DEFAULT_MAX_NODES      = 10000000;
+const size_t DEFAULT_MEM_LIMIT_MB   = 2048;
+
+//! @brief Every measurement is repeated, until about this number of nodes is processed.
+const size_t NODES_PER_MEASUREMENT  = 1000000;
+const size_t MAX_REPEATS            = 20;
+
+const uint64_t RANDOM_SEED          = 0x9e3779b97f4a7c15ULL;
+
+//! @brief Best times of operations over all repeats of one combination.
+struct BenchTimes
+{
+    uint64_t insert         = UINT64_MAX;
+    uint64_t walk           = UINT64_MAX;
+    uint64_t copy           = UINT64_MAX;
+    uint64_t migrate        = UINT64_MAX;
+    uint64_t save           = UINT64_MAX;
+    uint64_t export_flat    = UINT64_MAX;
+    uint64_t relayout       = UINT64_MAX;
+    uint64_t walk_relayout  = UINT64_MAX;   //< The same walk after tree_relayout().
+    uint64_t del            = UINT64_MAX;
+};
+
+//! @brief Node of the baseline tree: same links as TreeNode has, data goes right after it.
+struct CallocNode
+{
+    CallocNode *left    = NULL;
+    CallocNode *right   = NULL;
+    CallocNode *parent  = NULL;
+    size_t level        = 0;
+};
+
+inline uint64_t now_ns()
+{
+    timespec ts = {};
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+inline uint64_t xorshift( uint64_t *state )
+{
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+
+    return x;
+}
+
+inline void keep_min( uint64_t *best, uint64_t start )
+{
+    uint64_t time = now_ns() - start;
+    if ( time < *best )
+        *best = time;
+}
+
+//! @brief Does the same as tree_preorder_next(), but for the baseline tree.
+inline CallocNode *calloc_preorder_next( CallocNode *node_ptr )
+{
+    if ( node_ptr->left )
+        return node_ptr->left;
+    if ( node_ptr->right )
+        return node_ptr->right;
+
+    while ( node_ptr->parent )
+    {
+        CallocNode *parent = node_ptr->parent;
+        if ( parent->right && parent->right != node_ptr )
+            return parent->right;
+        node_ptr = parent;
+    }
+
+    return NULL;
+}
+
+//! @brief Builds the tree of the given shape. 'ops' must be able to:
+//! - root( data ), left( parent, data ), right( parent, data ) - insert a node and return it;
+//! - child( node, go_right ) - return the child of the node.
+//! 'nodes' must have place for 'nodes_count' pointers (used only for balanced shape).
+//! @return The root of the tree.
+template <typename Node, typename Ops>
+inline Node *build_shape( Ops ops, BenchShape shape, size_t nodes_count,
+                         Node **nodes, unsigned char *data )
+{
+    Node *root = ops.root( data );
+
+    switch (shape)
+    {
+    case BENCH_SHAPE_BALANCED:
+        // children of the node 'ind' are nodes '2 * ind + 1' and '2 * ind + 2'
+        nodes[0] = root;
+        for (size_t ind = 1; ind < nodes_count; ind++)
+        {
+            data[0] = (unsigned char) ind;
+            Node *parent = nodes[(ind - 1) / 2];
+            nodes[ind] = ( ind % 2 ? ops.left( parent, data ) : ops.right( parent, data ) );
+        }
+        break;
+    case BENCH_SHAPE_RANDOM:
+        {
+            // every node is put to the first free place on the random path from the root
+            uint64_t state = RANDOM_SEED;
+            for (size_t ind = 1; ind < nodes_count; ind++)
+            {
+                data[0] = (unsigned char) ind;
+                Node *curr = root;
+                while (true)
+                {
+                    bool go_right = xorshift( &state ) & 1;
+                    Node *child = ops.child( curr, go_right );
+                    if (!child)
+                    {
+                        if (go_right)
+                            ops.right( curr, data );
+                        else
+                            ops.left( curr, data );
+                        break;
+                    }
+                    curr = child;
+                }
+            }
+        }
+        break;
+    case BENCH_SHAPE_CHAIN:
+        {
+            Node *curr = root;
+            for (size_t ind = 1; ind < nodes_count; ind++)
+            {
+                data[0] = (unsigned char) ind;
+                curr = ops.right( curr, data );
+            }
+        }
+        break;
+    default:
+        assert(0 && "Unknown shape!");
+        break;
+    }
+
+    return root;
+}
+
+struct PoolOps
+{
+    Tree *tree_ptr;
+
+    TreeNode *root( unsigned char *data )
+    {
+        tree_insert_root( tree_ptr, data );
+        return tree_ptr->root;
+    }
+
+    TreeNode *left( TreeNode *parent, unsigned char *data )
+    {
+        tree_insert_data_as_left_child( tree_ptr, parent, data );
+        return tree_node_left(parent);
+    }
+
+    TreeNode *right( TreeNode *parent, unsigned char *data )
+    {
+        tree_insert_data_as_right_child( tree_ptr, parent, data );
+        return tree_node_right(parent);
+    }
+
+    TreeNode *child( TreeNode *node_ptr, bool go_right )
+    {
+        return ( go_right ? tree_node_right(node_ptr) : tree_node_left(node_ptr) );
+    }
+};
+
+struct CallocOps
+{
+    size_t payload;
+
+    CallocNode *new_node( CallocNode *parent, unsigned char *data )
+    {
+        CallocNode *node_ptr = (CallocNode *) calloc( 1, sizeof(CallocNode) + payload );
+        if (!node_ptr)
+        {
+            fprintf( stderr, "Can't allocate memory for the baseline tree!\n" );
+            exit( EXIT_FAILURE );
+        }
+
+        memcpy( (void *) (node_ptr + 1), data, payload );
+        node_ptr->parent = parent;
+        node_ptr->level  = ( parent ? parent->level + 1 : 0 );
+
+        return node_ptr;
+    }
+
+    CallocNode *root( unsigned char *data )
+    {
+        return new_node( NULL, data );
+    }
+
+    CallocNode *left( CallocNode *parent, unsigned char *data )
+    {
+        return parent->left = new_node( parent, data );
+    }
+
+    CallocNode *right( CallocNode *parent, unsigned char *data )
+    {
+        return parent->right = new_node( parent, data );
+    }
+
+    CallocNode *child( CallocNode *node_ptr, bool go_right )
+    {
+        return ( go_right ? node_ptr->right : node_ptr->left );
+    }
+};
+
+//! @brief Sums first bytes of data of all nodes, so that the walk can't be thrown away.
+inline size_t walk_tree( const Tree *tree_ptr )
+{
+    size_t sum = 0;
+    for ( TreeNode *curr = tree_ptr->root; curr; curr = tree_preorder_next( curr, tree_ptr->root ) )
+        sum += *(unsigned char *) tree_node_data(curr);
+
+    return sum;
+}
+
+inline size_t walk_calloc_tree( CallocNode *root )
+{
+    size_t sum = 0;
+    for ( CallocNode *curr = root; curr; curr = calloc_preorder_next( curr ) )
+        sum += *(unsigned char *) (curr + 1);
+
+    return sum;
+}
+
+//! @brief Frees nodes of the baseline tree in postorder, without recursion.
+inline void free_calloc_tree( CallocNode *root )
+{
+    CallocNode *curr = root;
+    while (curr)
+    {
+        if ( curr->left )
+            curr = curr->left;
+        else if ( curr->right )
+            curr = curr->right;
+        else
+        {
+            CallocNode *parent = curr->parent;
+            if (parent)
+            {
+                if ( parent->left == curr )
+                    parent->left = NULL;
+                else
+                    parent->right = NULL;
+            }
+            free( curr );
+            curr = parent;
+        }
+    }
+}
+
+//! @brief Moves the right subtree of the root to the left of the leftmost node. If the root
+//! is the leftmost node itself (as in chains), the subtree of the right child of
+//! the right child is moved instead. Levels of the whole moved subtree change.
+inline void migrate_tree( Tree *tree_ptr )
+{
+    TreeNode *leftmost = tree_ptr->root;
+    while ( tree_node_left(leftmost) )
+        leftmost = tree_node_left(leftmost);
+
+    TreeNode *migr = tree_node_right(tree_ptr->root);
+    if ( migr && leftmost == tree_ptr->root )
+        migr = tree_node_right(migr);
+    if (migr)
+        tree_migrate_into_left( tree_ptr, leftmost, migr );
+}
+
+inline void print_row( const char *op, BenchShape shape, size_t nodes_count,
+                       size_t payload, const char *alloc, uint64_t ns_total )
+{
+    printf( "%s,%s,%zu,%zu,%s,%llu,%.2f\n", op, SHAPES[shape], nodes_count, payload,
+            alloc, (unsigned long long) ns_total, (double) ns_total / (double) nodes_count );
+}
+
+//! @brief Measures all operations on the trees of the library.
+inline void bench_pool( BenchShape shape, size_t nodes_count, size_t payload, size_t repeats,
+                        TreeNode **nodes, unsigned char *data, FILE *null_stream, size_t *sink )
+{
+    BenchTimes times = {};
+
+    for (size_t rep = 0; rep < repeats; rep++)
+    {
+        Tree tree = {};
+#ifdef TREE_DO_DUMP
+        tree_ctor( &tree, payload, nodes_count, NULL, NULL );
+#else
+        tree_ctor( &tree, payload, nodes_count, NULL );
+#endif
+
+        uint64_t start = now_ns();
+        build_shape( PoolOps{ &tree }, shape, nodes_count, nodes, data );
+        keep_min( &times.insert, start );
+
+        start = now_ns();
+        *sink += walk_tree( &tree );
+        keep_min( &times.walk, start );
+
+        start = now_ns();
+        tree_save( &tree, null_stream );
+        keep_min( &times.save, start );
+
+        start = now_ns();
+        tree_export_flat( &tree, null_stream );
+        keep_min( &times.export_flat, start );
+
+        Tree copy = {};
+        start = now_ns();
+        tree_copy( &copy, &tree );
+        keep_min( &times.copy, start );
+
+        start = now_ns();
+        migrate_tree( &copy );
+        keep_min( &times.migrate, start );
+
+        tree_dtor( &copy );
+
+        start = now_ns();
+        tree_relayout( &tree, TREE_LAYOUT_PREORDER );
+        keep_min( &times.relayout, start );
+
+        start = now_ns();
+        *sink += walk_tree( &tree );
+        keep_min( &times.walk_relayout, start );
+
+        start = now_ns();
+        tree_delete_subtree( &tree, tree.root );
+        keep_min( &times.del, start );
+
+        tree_dtor( &tree );
+    }
+
+    print_row( "insert",        shape, nodes_count, payload, "pool", times.insert );
+    print_row( "walk",          shape, nodes_count, payload, "pool", times.walk );
+    print_row( "copy",          shape, nodes_count, payload, "pool", times.copy );
+    print_row( "migrate",       shape, nodes_count, payload, "pool", times.migrate );
+    print_row( "save",          shape, nodes_count, payload, "pool", times.save );
+    print_row( "export_flat",   shape, nodes_count, payload, "pool", times.export_flat );
+    print_row( "relayout",      shape, nodes_count, payload, "pool", times.relayout );
+    print_row( "walk_relayout", shape, nodes_count, payload, "pool", times.walk_relayout );
+    print_row( "delete",        shape, nodes_count, payload, "pool", times.del );
+}
+
+//! @brief Measures building, walking and deleting of the baseline tree.
+inline void bench_calloc( BenchShape shape, size_t nodes_count, size_t payload, size_t repeats,
+                          CallocNode **nodes, unsigned char *data, size_t *sink )
+{
+    BenchTimes times = {};
+
+    for (size_t rep = 0; rep < repeats; rep++)
+    {
+        CallocOps ops = { payload };
+
+        uint64_t start = now_ns();
+        CallocNode *root = build_shape( ops, shape, nodes_count, nodes, data );
+        keep_min( &times.insert, start );
+
+        start = now_ns();
+        *sink += walk_calloc_tree( root );
+        keep_min( &times.walk, start );
+
+        start = now_ns();
+        free_calloc_tree( root );
+        keep_min( &times.del, start );
+    }
+
+    print_row( "insert",    shape, nodes_count, payload, "calloc", times.insert );
+    print_row( "walk",      shape, nodes_count, payload, "calloc", times.walk );
+    print_row( "delete",    shape, nodes_count, payload, "calloc", times.del );
+}
+
+int main( int argc, char *argv[] )
+{
+    size_t max_nodes    = ( argc > 1 ? strtoull( argv[1], NULL, 10 ) : DEFAULT_MAX_NODES );
+    size_t mem_limit_mb = ( argc > 2 ? strtoull( argv[2], NULL, 10 ) : DEFAULT_MEM_LIMIT_MB );
+
+    FILE *null_stream = fopen( "/dev/null", "wb" );
+    if (!null_stream)
+    {
+        fprintf( stderr, "Can't open /dev/null!\n" );
+        return EXIT_FAILURE;
+    }
+
+    size_t sink = 0;
+
+    printf( "op,shape,nodes,payload,alloc,ns_total,ns_per_node\n" );
+
+    for ( size_t nodes_count : SIZES )
+    {
+        if ( nodes_count > max_nodes )
+            break;
+
+        size_t repeats = NODES_PER_MEASUREMENT / nodes_count;
+        if ( repeats == 0 )
+            repeats = 1;
+        if ( repeats > MAX_REPEATS )
+            repeats = MAX_REPEATS;
+
+        void **nodes = (void **) calloc( nodes_count, sizeof(void *) );
+        if (!nodes)
+        {
+            fprintf( stderr, "Can't allocate memory for %zu nodes!\n", nodes_count );
+            return EXIT_FAILURE;
+        }
+
+        for ( size_t payload : PAYLOADS )
+        {
+            // the tree and its copy (or its new blocks during relayout) live at the same time
+            size_t need_mb = 2 * nodes_count * ( sizeof(TreeNode) + payload ) / (1 << 20);
+            if ( need_mb > mem_limit_mb )
+            {
+                fprintf( stderr, "Skipped %zu nodes with payload %zu: needs about %zu MB.\n",
+                         nodes_count, payload, need_mb );
+                continue;
+            }
+
+            unsigned char *data = (unsigned char *) calloc( 1, payload );
+            if (!data)
+                return EXIT_FAILURE;
+
+            for (size_t shape = 0; shape < sizeof(SHAPES) / sizeof(SHAPES[0]); shape++)
+            {
+                bench_pool(     (BenchShape) shape, nodes_count, payload, repeats,
+                                (TreeNode **) nodes, data, null_stream, &sink );
+                bench_calloc(   (BenchShape) shape, nodes_count, payload, repeats,
+                                (CallocNode **) nodes, data, &sink );
+                fflush( stdout );
+            }
+
+            free( data );
+        }
+
+        free( nodes );
+    }
+
+    fclose( null_stream );
+
+    // the sum is printed, so that walks can't be optimized out
+    fprintf( stderr, "Done (checksum %zu).\n", sink );
+
+    return 0;
+}
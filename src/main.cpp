@@ -29,8 +29,45 @@ int main()
 
     TREE_DUMP(&tree, 0);
 
+    // save -> load round trip of a tree with a loose chain, which is not saved
+    // and is deeper than the tree itself
+    TreeNode *loose_chain[3] = {};
+    for (size_t ind = 0; ind < 3; ind++)
+    {
+        loose_chain[ind] = op_new_TreeNode( &tree, &arr[4 + ind] );
+        if (ind)
+            tree_hang_loose_node_at_left( &tree, loose_chain[ind], loose_chain[ind - 1] );
+    }
+
+    Tree loaded = {};
+#ifdef TREE_DO_DUMP
+    tree_ctor(&loaded, sizeof(int), 20, NULL, int_print);
+#else
+    tree_ctor(&loaded, sizeof(int), 20, NULL);
+#endif
+
+    FILE *stream = tmpfile();
+    bool round_trip_ok = stream
+                      && tree_save( &tree, stream ) == TREE_STATUS_OK
+                      && fseek( stream, 0, SEEK_SET ) == 0
+                      && tree_load( &loaded, stream ) == TREE_STATUS_OK
+                      && loaded.nodes_count == 2
+                      && *(int *) tree_get_data_ptr( tree_get_left_child( tree_get_root( &loaded ) ) ) == arr[1];
+    if (stream)
+        fclose(stream);
+
+    for (size_t ind = 3; ind > 0; ind--)
+        op_del_TreeNode( &tree, loose_chain[ind - 1] );
+
+    tree_dtor(&loaded);
     tree_dtor(&tree);
 
+    if ( !round_trip_ok )
+    {
+        printf("save -> load round trip failed\n");
+        return 1;
+    }
+
     printf("all is ok\n");
 
     return 0;
@@ -1,10 +1,15 @@
 #include "tree.h"
 // #include "tree_dump.h"
 #include "tree_alloc.h"
+#include "tree_par.h"
 
 #include <stdio.h>
 #include <assert.h>
 #include <memory.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <new>
 
 
 TreeStatus tree_ctor_( Tree *tree_ptr,
@@ -24,64 +29,103 @@ TreeStatus tree_ctor_( Tree *tree_ptr,
     tree_ptr->data_dtor_func_ptr    = data_dtor_func_ptr;
     tree_ptr->nodes_count           = 0;
     tree_ptr->depth                 = 0;
+    tree_ptr->level_hist            = NULL;
+    tree_ptr->level_hist_cap        = 0;
     tree_ptr->root                  = NULL;
 
     tree_ptr->typical_num_of_nodes  = typical_num_of_nodes;
-
-    _tree_alloc_init( sizeof(TreeNode) + data_size_in_bytes, typical_num_of_nodes );
+    tree_ptr->threads_count         = 1;
+    tree_ptr->persistent            = false;
+    tree_ptr->snapshots_count       = 0;
+    tree_ptr->hash_cache            = false;
+
+    TreeAllocRes alloc_res = _tree_alloc_init(  &tree_ptr->alloc,
+                                                sizeof(TreeNode) + data_size_in_bytes,
+                                                typical_num_of_nodes );
+    if ( alloc_res == TREE_ALLOC_ERR_CANT_ALLOC_MEM )
+        return TREE_STATUS_ERROR_MEM_ALLOC;
+    if ( alloc_res != TREE_ALLOC_OK )
+        return TREE_STATUS_ERROR_ALLOC_INIT;
 
 #ifdef TREE_DO_DUMP
     tree_ptr->print_data_func_ptr   = print_data_func_ptr;
     tree_ptr->orig_info             = orig_info;
+    tree_ptr->selfcheck_calls       = 0;
 #endif
 
     return TREE_STATUS_OK;
 }
 
-//! @brief Applies 'data_dtor' to every node in the given tree.
-//! @note  Uses the fact that nodes are connected in a list.
+//! @brief Applies 'data_dtor' to every node of the tree (including loose ones),
+//! walking live blocks of the allocator.
 //! @attention 'tree_ptr->data_dtor_func_ptr' MUSTN'T BE NULL! 
 inline void dtor_all_nodes_data( Tree *tree_ptr )
 {
     assert(tree_ptr);
     assert(tree_ptr->data_dtor_func_ptr);
 
-    TreeNode *curr_node = tree_ptr->head_of_all_nodes;
-    while (curr_node)
-    {
-        tree_ptr->data_dtor_func_ptr( curr_node->data_ptr );
-
-        curr_node = curr_node->next;
-    }
+    for ( TreeNode *curr = _tree_alloc_first_live( tree_ptr->alloc ); curr;
+          curr = _tree_alloc_next_live( tree_ptr->alloc, curr ) )
+        tree_ptr->data_dtor_func_ptr( tree_node_data(curr) );
 }
 
 TreeStatus tree_dtor( Tree *tree_ptr )
 {
     assert(tree_ptr);
+    TREE_TRACE(tree_ptr, DTOR);
 
     if ( tree_ptr->data_dtor_func_ptr )
         dtor_all_nodes_data( tree_ptr );
 
-    _tree_alloc_deinit();
+    if ( tree_ptr->alloc )
+        _tree_alloc_deinit( &tree_ptr->alloc );
+
+    free( tree_ptr->level_hist );
 
     tree_ptr->root                  = NULL;
     tree_ptr->nodes_count           = 0;
     tree_ptr->depth                 = 0;
+    tree_ptr->level_hist            = NULL;
+    tree_ptr->level_hist_cap        = 0;
     tree_ptr->data_size             = 0;
     tree_ptr->data_dtor_func_ptr    = NULL;
+    tree_ptr->persistent            = false;
+    tree_ptr->snapshots_count       = 0;
+    tree_ptr->hash_cache            = false;
 
 #ifdef TREE_DO_DUMP
     tree_ptr->print_data_func_ptr   = NULL;
     tree_ptr->orig_info             = {};
+    tree_ptr->selfcheck_calls       = 0;
 #endif
 
     return TREE_STATUS_OK;
 }
 
+TreeStatus tree_set_max_mem_pool_size( Tree *tree_ptr, size_t max_mem_pool_size )
+{
+    TREE_SELFCHECK(tree_ptr);
+
+    if ( _tree_alloc_set_max_mem_pool_size( tree_ptr->alloc, max_mem_pool_size ) != TREE_ALLOC_OK )
+        return TREE_STATUS_ERROR_ALLOC_INIT;
+
+    return TREE_STATUS_OK;
+}
+
+TreeStatus tree_set_threads_count( Tree *tree_ptr, size_t threads_count )
+{
+    TREE_SELFCHECK(tree_ptr);
+
+    tree_ptr->threads_count = _tree_par_threads_count( threads_count );
+
+    return TREE_STATUS_OK;
+}
+
 TreeStatus tree_insert_root( Tree *tree_ptr, void *data )
 {
     TREE_SELFCHECK(tree_ptr);
     assert(data);
+    TREE_TRACE(tree_ptr, INSERT_ROOT);
 
     if (tree_ptr->root)
         return TREE_STATUS_WARNING_ROOT_ALREADY_EXISTS;
@@ -100,15 +144,20 @@ TreeStatus tree_insert_data_as_left_child( Tree *tree_ptr, TreeNode *node_ptr, v
     TREE_SELFCHECK(tree_ptr);
     assert(node_ptr);
     assert(data);
+    TREE_TRACE(tree_ptr, INSERT_LEFT);
 
-    if ( node_ptr->left )
+    if ( tree_node_left(node_ptr) )
         return TREE_STATUS_WARNING_LEFT_CHILD_IS_OCCUPIED;
 
+    if ( !_tree_pers_is_writable( tree_ptr, node_ptr ) )
+        return TREE_STATUS_WARNING_NODE_IS_SHARED;
+
     TreeNode *new_node = op_new_TreeNode(tree_ptr, data, node_ptr);
     if (!new_node)
         return TREE_STATUS_ERROR_MEM_ALLOC;
 
-    node_ptr->left = new_node;
+    tree_node_set_left( node_ptr, new_node );
+    _tree_hash_invalidate( tree_ptr, node_ptr );
 
     return TREE_STATUS_OK;
 }
@@ -118,15 +167,20 @@ TreeStatus tree_insert_data_as_right_child( Tree *tree_ptr, TreeNode *node_ptr,
     TREE_SELFCHECK(tree_ptr);
     assert(node_ptr);
     assert(data);
+    TREE_TRACE(tree_ptr, INSERT_RIGHT);
 
-    if ( node_ptr->right )
+    if ( tree_node_right(node_ptr) )
         return TREE_STATUS_WARNING_RIGHT_CHILD_IS_OCCUPIED;
 
+    if ( !_tree_pers_is_writable( tree_ptr, node_ptr ) )
+        return TREE_STATUS_WARNING_NODE_IS_SHARED;
+
     TreeNode *new_node = op_new_TreeNode(tree_ptr, data, node_ptr);
     if (!new_node)
         return TREE_STATUS_ERROR_MEM_ALLOC;
 
-    node_ptr->right = new_node;
+    tree_node_set_right( node_ptr, new_node );
+    _tree_hash_invalidate( tree_ptr, node_ptr );
 
     return TREE_STATUS_OK;
 }
@@ -137,7 +191,7 @@ TreeStatus tree_get_data( const Tree *tree_ptr, const TreeNode *node_ptr, void *
     assert(node_ptr);
     assert(ret);
 
-    memcpy(ret, node_ptr->data_ptr, tree_ptr->data_size);
+    memcpy(ret, tree_node_data(node_ptr), tree_ptr->data_size);
 
     return TREE_STATUS_OK;
 }
@@ -146,13 +200,13 @@ void *tree_get_data_ptr( const TreeNode *node_ptr )
 {
     assert(node_ptr);
 
-    return node_ptr->data_ptr;
+    return tree_node_data(node_ptr);
 }
 
 TreeNode *tree_get_parent( const TreeNode *node_ptr )
 {
     assert(node_ptr);
-    return node_ptr->parent;
+    return tree_node_parent(node_ptr);
 }
 
 TreeStatus tree_change_data( Tree *tree_ptr, TreeNode *node_ptr, void *new_data )
@@ -160,9 +214,14 @@ TreeStatus tree_change_data( Tree *tree_ptr, TreeNode *node_ptr, void *new_data
     TREE_SELFCHECK(tree_ptr);
     assert(node_ptr);
     assert(new_data);
+    TREE_TRACE(tree_ptr, CHANGE_DATA);
+
+    if ( !_tree_pers_is_writable( tree_ptr, node_ptr ) )
+        return TREE_STATUS_WARNING_NODE_IS_SHARED;
 
-    if (tree_ptr->data_dtor_func_ptr) tree_ptr->data_dtor_func_ptr(node_ptr->data_ptr);
-    memcpy( node_ptr->data_ptr, new_data, tree_ptr->data_size );
+    if (tree_ptr->data_dtor_func_ptr) tree_ptr->data_dtor_func_ptr(tree_node_data(node_ptr));
+    memcpy( tree_node_data(node_ptr), new_data, tree_ptr->data_size );
+    _tree_hash_invalidate( tree_ptr, node_ptr );
 
     return TREE_STATUS_OK;
 }
@@ -178,19 +237,20 @@ TreeNode* tree_get_left_child( const TreeNode *node_ptr )
 {
     assert(node_ptr);
 
-    return node_ptr->left;
+    return tree_node_left(node_ptr);
 }
 
 TreeNode* tree_get_right_child( const TreeNode *node_ptr )
 {
     assert(node_ptr);
 
-    return node_ptr->right;
+    return tree_node_right(node_ptr);
 }
 
 TreeStatus tree_delete_root( Tree *tree_ptr )
 {
     TREE_SELFCHECK(tree_ptr);
+    TREE_TRACE(tree_ptr, DELETE_ROOT);
 
     if (!tree_ptr->root)
         return TREE_STATUS_WARNING_REQUEST_TO_DEL_NULL_NODE;
@@ -206,16 +266,21 @@ TreeStatus tree_delete_left_child( Tree *tree_ptr, TreeNode *node_ptr )
 {
     TREE_SELFCHECK(tree_ptr);
     assert(node_ptr);
+    TREE_TRACE(tree_ptr, DELETE_LEFT_CHILD);
 
-    if ( !node_ptr->left )
+    if ( !tree_node_left(node_ptr) )
         return TREE_STATUS_WARNING_REQUEST_TO_DEL_NULL_NODE;
 
-    if ( !is_node_leaf(node_ptr->left) )
+    if ( !is_node_leaf(tree_node_left(node_ptr)) )
         return TREE_STATUS_WARNING_REQUEST_TO_DEL_NOT_A_LEAF;
 
-    op_del_TreeNode(tree_ptr, node_ptr->left);
+    if ( !_tree_pers_is_writable( tree_ptr, node_ptr ) )
+        return TREE_STATUS_WARNING_NODE_IS_SHARED;
 
-    node_ptr->left = NULL;
+    op_del_TreeNode(tree_ptr, tree_node_left(node_ptr));
+
+    tree_node_set_left( node_ptr, NULL );
+    _tree_hash_invalidate( tree_ptr, node_ptr );
 
     return TREE_STATUS_OK;
 }
@@ -224,33 +289,477 @@ TreeStatus tree_delete_right_child( Tree *tree_ptr, TreeNode *node_ptr )
 {
     TREE_SELFCHECK(tree_ptr);
     assert(node_ptr);
+    TREE_TRACE(tree_ptr, DELETE_RIGHT_CHILD);
 
-    if ( !node_ptr->right )
+    if ( !tree_node_right(node_ptr) )
         return TREE_STATUS_WARNING_REQUEST_TO_DEL_NULL_NODE;
 
-    if ( !is_node_leaf(node_ptr->right) )
+    if ( !is_node_leaf(tree_node_right(node_ptr)) )
         return TREE_STATUS_WARNING_REQUEST_TO_DEL_NOT_A_LEAF;
 
-    op_del_TreeNode(tree_ptr, node_ptr->right);
+    if ( !_tree_pers_is_writable( tree_ptr, node_ptr ) )
+        return TREE_STATUS_WARNING_NODE_IS_SHARED;
+
+    op_del_TreeNode(tree_ptr, tree_node_right(node_ptr));
+
+    tree_node_set_right( node_ptr, NULL );
+    _tree_hash_invalidate( tree_ptr, node_ptr );
+
+    return TREE_STATUS_OK;
+}
+
+//! @brief Makes sure that 'level_hist' has space for levels up to 'max_level' inclusive.
+inline TreeStatus level_hist_reserve( Tree *tree_ptr, size_t max_level )
+{
+    assert(tree_ptr);
+
+    if ( max_level < tree_ptr->level_hist_cap )
+        return TREE_STATUS_OK;
+
+    size_t new_cap = ( tree_ptr->level_hist_cap == 0 ? 16 : tree_ptr->level_hist_cap );
+    while ( new_cap <= max_level )
+        new_cap *= 2;
+
+    size_t *new_hist = (size_t *) realloc( tree_ptr->level_hist, new_cap * sizeof(size_t) );
+    if (!new_hist)
+        return TREE_STATUS_ERROR_MEM_ALLOC;
+
+    memset( new_hist + tree_ptr->level_hist_cap, 0, (new_cap - tree_ptr->level_hist_cap) * sizeof(size_t) );
+
+    tree_ptr->level_hist        = new_hist;
+    tree_ptr->level_hist_cap    = new_cap;
+
+    return TREE_STATUS_OK;
+}
+
+//! @attention 'level_hist' must already have space for 'level'.
+inline void level_hist_inc( Tree *tree_ptr, size_t level )
+{
+    assert(level < tree_ptr->level_hist_cap);
+
+    tree_ptr->level_hist[level]++;
+
+    if ( tree_ptr->depth < level )
+        tree_ptr->depth = level;
+}
+
+inline void level_hist_dec( Tree *tree_ptr, size_t level )
+{
+    assert(level < tree_ptr->level_hist_cap);
+    assert(tree_ptr->level_hist[level] > 0);
+
+    tree_ptr->level_hist[level]--;
+
+    while ( tree_ptr->depth > 0 && tree_ptr->level_hist[tree_ptr->depth] == 0 )
+        tree_ptr->depth--;
+}
+
+//! @brief Gives back to the allocator the node, which is being released
+//! together with its whole subtree. Unlike op_del_TreeNode(), doesn't unlink
+//! the node from its parent and doesn't clear its fields, because the parent
+//! is going to be released too (or is unlinked by the caller).
+//! @note In persistent mode the node is only taken out of the current version
+//! of the tree, it is freed later by _tree_pers_unref(), if snapshots don't use it.
+inline void release_node_in_bulk( Tree *tree_ptr, TreeNode *node_ptr )
+{
+    if ( tree_ptr->data_dtor_func_ptr ) tree_ptr->data_dtor_func_ptr( tree_node_data(node_ptr) );
+
+    level_hist_dec( tree_ptr, tree_node_level(node_ptr) );
+
+    if ( !tree_ptr->persistent )
+        _tree_alloc_del( tree_ptr->alloc, node_ptr );
+}
+
+//! @brief Releases all nodes of the subtree, starting with 'start_with', in one
+//! postorder pass, without recursion. The subtree of 'except_node' (if it is met)
+//! is not released.
+//! @note Link from the parent of 'start_with' to 'start_with' is left untouched,
+//! caller must take care of it. In persistent mode this link is counted
+//! as removed, and 'except_node' must already have a new link.
+//! @return 1 if the 'except_node' is in the released subtree, 0 otherwise.
+inline int release_subtree( Tree *tree_ptr, TreeNode *start_with, const TreeNode *except_node )
+{
+    assert(tree_ptr);
+    assert(start_with);
+
+    int except_node_found = 0;
+    size_t released = 0;
+
+    TreeNode *stop = tree_node_parent(start_with);
+    TreeNode *curr = start_with;
+    TreeNode *prev = stop;
+
+    while ( curr != stop )
+    {
+        TreeNode *left  = tree_node_left(curr);
+        TreeNode *right = tree_node_right(curr);
+
+        if ( left && left == except_node )
+        {
+            except_node_found = 1;
+            left = NULL;
+        }
+        if ( right && right == except_node )
+        {
+            except_node_found = 1;
+            right = NULL;
+        }
+
+        TreeNode *next = NULL;
+        if ( prev == tree_node_parent(curr) && left )
+            next = left;
+        else if ( right && prev != right )
+            next = right;
+
+        if ( next )
+        {
+            prev = curr;
+            curr = next;
+            continue;
+        }
+
+        // both subtrees are already released
+        next = tree_node_parent(curr);
+        release_node_in_bulk( tree_ptr, curr );
+        released++;
+
+        prev = curr;
+        curr = next;
+    }
+
+    tree_ptr->nodes_count -= released;
+
+    if ( tree_ptr->persistent )
+        _tree_pers_unref( tree_ptr, start_with );
+
+    return except_node_found;
+}
+
+//! @brief Sets level of 'subtree' to 'new_level' and updates levels of all its
+//! descendants accordingly. Nodes outside the subtree are not touched, and if level
+//! of 'subtree' is already correct, nothing is done at all.
+inline TreeStatus relevel_subtree( Tree *tree_ptr, TreeNode *subtree, size_t new_level )
+{
+    assert(tree_ptr);
+    assert(subtree);
 
-    node_ptr->right = NULL;
+    size_t old_level = tree_node_level(subtree);
+    if ( old_level == new_level )
+        return TREE_STATUS_OK;
+
+    if ( new_level > old_level )
+        WRP_RET( level_hist_reserve( tree_ptr, tree_ptr->depth + (new_level - old_level) ) );
+
+    size_t moved = 0;
+    for ( TreeNode *curr = subtree; curr; curr = tree_preorder_next( curr, subtree ) )
+    {
+        size_t curr_new_level = tree_node_level(curr) - old_level + new_level;
+        level_hist_inc( tree_ptr, curr_new_level );
+        level_hist_dec( tree_ptr, tree_node_level(curr) );
+        tree_node_set_level( curr, curr_new_level );
+        moved++;
+    }
+    TREE_TRACE_TOUCH( moved );
 
     return TREE_STATUS_OK;
 }
 
-inline TreeNode *tree_copy_node( Tree *dest, TreeNode* parent, const TreeNode *src )
+//! @brief Copies subtree of 'src' into 'dest' tree, without recursion: 'src' is walked
+//! in preorder, while the copy is walked in lockstep with it. Root of the copy gets
+//! 'parent' as its parent, but 'parent' is not linked to the copy.
+//! @return Root of the copy, or NULL if memory can't be allocated (then nothing is copied).
+inline TreeNode *tree_copy_node_seq( Tree *dest, TreeNode* parent, const TreeNode *src )
 {
+    assert(dest);
     assert(src);
 
-    TreeNode *node = op_new_TreeNode( dest, src->data_ptr, parent );
+    TreeNode *copy = op_new_TreeNode( dest, tree_node_data(src), parent );
+    if (!copy)
+        return NULL;
+
+    const TreeNode *src_curr = src;
+    TreeNode *copy_curr = copy;
+    for ( const TreeNode *src_next = tree_preorder_next( src_curr, src );
+          src_next;
+          src_next = tree_preorder_next( src_curr, src ) )
+    {
+        // 'src_next' is a child of 'src_curr' or of one of its ancestors
+        const TreeNode *src_next_parent = tree_node_parent(src_next);
+        while ( src_curr != src_next_parent )
+        {
+            src_curr    = tree_node_parent(src_curr);
+            copy_curr   = tree_node_parent(copy_curr);
+        }
+
+        TreeNode *copy_next = op_new_TreeNode( dest, tree_node_data(src_next), copy_curr );
+        if (!copy_next)
+        {
+            // data of the copy is a shallow copy of src's one, so it mustn't be destructed
+            void (*data_dtor_func_ptr)(void *data_ptr) = dest->data_dtor_func_ptr;
+            dest->data_dtor_func_ptr = NULL;
+            release_subtree( dest, copy, NULL );
+            dest->data_dtor_func_ptr = data_dtor_func_ptr;
+
+            return NULL;
+        }
+
+        if ( tree_node_left(src_curr) == src_next )
+            tree_node_set_left( copy_curr, copy_next );
+        else
+            tree_node_set_right( copy_curr, copy_next );
+
+        src_curr    = src_next;
+        copy_curr   = copy_next;
+    }
+
+    return copy;
+}
 
-    if (src->left)
-        node->left = tree_copy_node( dest, node, src->left );
+//! @brief Subtrees with less nodes are copied by tree_copy() in one thread.
+const size_t TREE_PAR_COPY_MIN_NODES = 1 << 14;
+
+//! @brief State of one worker of parallel copy. Nodes, created by the worker,
+//! are accounted here, and added to the tree only after all workers are finished.
+struct ParCopyWorker
+{
+    TreeAllocCache cache = {};
 
-    if (src->right)
-        node->right = tree_copy_node( dest, node, src->right );
+    size_t nodes_count  = 0;
+    size_t *level_hist  = NULL;
+    size_t level_hist_cap = 0;
+};
 
-    return node;
+struct ParCopyCtx
+{
+    Tree *dest = NULL;
+    ParCopyWorker *workers = NULL;
+    std::atomic<int> failed{0};
+};
+
+inline int par_copy_level_hist_inc( ParCopyWorker *worker, size_t level )
+{
+    if ( level >= worker->level_hist_cap )
+    {
+        size_t new_cap = ( worker->level_hist_cap == 0 ? 16 : worker->level_hist_cap );
+        while ( new_cap <= level )
+            new_cap *= 2;
+
+        size_t *new_hist = (size_t *) realloc( worker->level_hist, new_cap * sizeof(size_t) );
+        if (!new_hist)
+            return 0;
+
+        memset( new_hist + worker->level_hist_cap, 0, (new_cap - worker->level_hist_cap) * sizeof(size_t) );
+        worker->level_hist      = new_hist;
+        worker->level_hist_cap  = new_cap;
+    }
+
+    worker->level_hist[level]++;
+
+    return 1;
+}
+
+//! @brief Creates copy of 'src' with 'parent' as its parent (but 'parent' is not linked to it).
+//! Unlike op_new_TreeNode(), doesn't touch 'dest' except for taking blocks from its allocator
+//! (through the cache of the worker).
+inline TreeNode *par_copy_new_node( ParCopyCtx *ctx, ParCopyWorker *worker,
+                                    const TreeNode *src, TreeNode *parent )
+{
+    size_t level = tree_node_level(parent) + 1;
+    if ( !par_copy_level_hist_inc( worker, level ) )
+        return NULL;
+
+    char *new_mem = (char *) _tree_alloc_cache_new( &worker->cache );
+    if (!new_mem)
+    {
+        worker->level_hist[level]--;
+        return NULL;
+    }
+
+    TreeNode *new_node = (TreeNode *) new_mem;
+#ifndef TREE_COMPACT_NODES
+    new_node->data_ptr = (void*) (new_mem + sizeof(TreeNode));
+#endif
+
+    tree_node_set_parent( new_node, parent );
+    tree_node_set_level( new_node, level );
+    memcpy( tree_node_data(new_node), tree_node_data(src), ctx->dest->data_size );
+
+    worker->nodes_count++;
+
+    return new_node;
+}
+
+//! @brief Task of parallel copy: 'task.node' is already copied into 'task.arg',
+//! copies all its descendants. Walks the source and the copy in lockstep, and when
+//! the deque of the worker is empty, gives the right subtree of the current node away as
+//! a new task (its root is copied and linked right away, so no stitching is needed later).
+static void par_copy_run( TreeParPool *pool, size_t worker_id, TreeParTask task )
+{
+    ParCopyCtx *ctx = (ParCopyCtx *) _tree_par_ctx( pool );
+    ParCopyWorker *worker = &ctx->workers[worker_id];
+
+    const TreeNode *src_root = task.node;
+    const TreeNode *src_curr = src_root;
+    TreeNode *copy_curr = (TreeNode *) task.arg;
+
+    while ( true )
+    {
+        if ( _tree_par_is_cancelled( pool ) )
+            return;
+
+        const TreeNode *src_left  = tree_node_left(src_curr);
+        const TreeNode *src_right = tree_node_right(src_curr);
+
+        if ( src_left && src_right && !tree_node_right(copy_curr) && _tree_par_wants_fork( pool, worker_id ) )
+        {
+            TreeNode *copy_right = par_copy_new_node( ctx, worker, src_right, copy_curr );
+            if (!copy_right)
+                break;
+            tree_node_set_right( copy_curr, copy_right );
+
+            TreeParTask right_task = {};
+            right_task.node = src_right;
+            right_task.arg  = copy_right;
+            if ( !_tree_par_fork( pool, worker_id, right_task ) )
+                break;
+        }
+
+        const TreeNode *src_next = NULL;
+        if ( src_left && !tree_node_left(copy_curr) )
+            src_next = src_left;
+        else if ( src_right && !tree_node_right(copy_curr) )
+            src_next = src_right;
+
+        if ( src_next )
+        {
+            TreeNode *copy_next = par_copy_new_node( ctx, worker, src_next, copy_curr );
+            if (!copy_next)
+                break;
+
+            if ( src_next == src_left )
+                tree_node_set_left( copy_curr, copy_next );
+            else
+                tree_node_set_right( copy_curr, copy_next );
+
+            src_curr    = src_next;
+            copy_curr   = copy_next;
+            continue;
+        }
+
+        // both subtrees are copied (or given away)
+        if ( src_curr == src_root )
+            return;
+
+        src_curr    = tree_node_parent(src_curr);
+        copy_curr   = tree_node_parent(copy_curr);
+    }
+
+    // some memory can't be allocated
+    ctx->failed.store( 1, std::memory_order_relaxed );
+    _tree_par_cancel( pool );
+}
+
+//! @brief Adds nodes, created by the worker, into the tree and gives back unused blocks.
+inline TreeStatus par_copy_merge_worker( Tree *dest, ParCopyWorker *worker )
+{
+    _tree_alloc_cache_flush( &worker->cache );
+
+    if ( worker->level_hist_cap )
+        WRP_RET( level_hist_reserve( dest, worker->level_hist_cap - 1 ) );
+
+    for (size_t level = 0; level < worker->level_hist_cap; level++)
+    {
+        if ( worker->level_hist[level] == 0 )
+            continue;
+
+        dest->level_hist[level] += worker->level_hist[level];
+        if ( dest->depth < level )
+            dest->depth = level;
+    }
+
+    dest->nodes_count += worker->nodes_count;
+
+    return TREE_STATUS_OK;
+}
+
+//! @brief Does the same as tree_copy_node_seq(), but in 'threads_count' threads.
+inline TreeNode *tree_copy_node_par( Tree *dest, TreeNode* parent, const TreeNode *src, size_t threads_count )
+{
+    assert(dest);
+    assert(src);
+
+    TreeNode *copy = op_new_TreeNode( dest, tree_node_data(src), parent );
+    if (!copy)
+        return NULL;
+
+    ParCopyCtx ctx = {};
+    ctx.dest    = dest;
+    ctx.workers = new (std::nothrow) ParCopyWorker[threads_count];
+    if (!ctx.workers)
+    {
+        op_del_TreeNode( dest, copy );
+        return NULL;
+    }
+
+    for (size_t ind = 0; ind < threads_count; ind++)
+        _tree_alloc_cache_init( &ctx.workers[ind].cache, dest->alloc );
+
+    TreeParTask task = {};
+    task.node   = src;
+    task.arg    = copy;
+
+    _tree_alloc_set_concurrent( dest->alloc, true );
+    TreeStatus status = _tree_par_run( threads_count, par_copy_run, &ctx, &task, 1 );
+    _tree_alloc_set_concurrent( dest->alloc, false );
+
+    // nodes, copied by now, are added to the tree even on error, so that they can be released
+    for (size_t ind = 0; ind < threads_count; ind++)
+    {
+        TreeStatus merge_status = par_copy_merge_worker( dest, &ctx.workers[ind] );
+        if ( status == TREE_STATUS_OK )
+            status = merge_status;
+
+        free( ctx.workers[ind].level_hist );
+    }
+    delete [] ctx.workers;
+
+    if ( status == TREE_STATUS_OK && ctx.failed.load( std::memory_order_relaxed ) )
+        status = TREE_STATUS_ERROR_MEM_ALLOC;
+
+    if ( status != TREE_STATUS_OK )
+    {
+        // data of the copy is a shallow copy of src's one, so it mustn't be destructed
+        void (*data_dtor_func_ptr)(void *data_ptr) = dest->data_dtor_func_ptr;
+        dest->data_dtor_func_ptr = NULL;
+        release_subtree( dest, copy, NULL );
+        dest->data_dtor_func_ptr = data_dtor_func_ptr;
+
+        return NULL;
+    }
+
+    return copy;
+}
+
+//! @brief Returns 1 if the subtree has at least 'min_count' nodes, 0 otherwise.
+//! Walks not more than 'min_count' nodes of it.
+inline int subtree_has_nodes( const TreeNode *subtree_root, size_t min_count )
+{
+    size_t count = 0;
+    for ( const TreeNode *curr = subtree_root; curr && count < min_count; curr = tree_preorder_next( curr, subtree_root ) )
+        count++;
+
+    return count >= min_count;
+}
+
+//! @brief Copies the subtree in 'threads_count' threads, if it has at least
+//! TREE_PAR_COPY_MIN_NODES nodes, and in one thread otherwise.
+inline TreeNode *tree_copy_node( Tree *dest, TreeNode* parent, const TreeNode *src, size_t threads_count )
+{
+    // starting threads costs much more than copying of small subtrees
+    if ( threads_count > 1 && subtree_has_nodes( src, TREE_PAR_COPY_MIN_NODES ) )
+        return tree_copy_node_par( dest, parent, src, threads_count );
+
+    return tree_copy_node_seq( dest, parent, src );
 }
 
 TreeStatus tree_copy( Tree *dest, const Tree *src )
@@ -258,15 +767,29 @@ TreeStatus tree_copy( Tree *dest, const Tree *src )
     assert(src);
     assert(dest);
     TREE_SELFCHECK(src);
+    TREE_TRACE(src, COPY);
 
 #ifdef TREE_DO_DUMP
-    tree_ctor(dest, src->data_size, src->typical_num_of_nodes, src->data_dtor_func_ptr, src->print_data_func_ptr);
+    WRP_RET( tree_ctor(dest, src->data_size, src->typical_num_of_nodes, src->data_dtor_func_ptr, src->print_data_func_ptr) );
 #else /* NOT TREE_DO_DUMP */
-    tree_ctor(dest, src->data_size, src->typical_num_of_nodes, src->data_dtor_func_ptr);
+    WRP_RET( tree_ctor(dest, src->data_size, src->typical_num_of_nodes, src->data_dtor_func_ptr) );
 #endif
 
+    dest->threads_count = src->threads_count;
+
     if (src->root)
-        dest->root = tree_copy_node( dest, NULL, src->root );
+    {
+        dest->root = tree_copy_node( dest, NULL, src->root, src->threads_count );
+        if (!dest->root)
+        {
+            // nothing is copied, but 'dest' is already constructed
+            tree_dtor( dest );
+            return TREE_STATUS_ERROR_MEM_ALLOC;
+        }
+    }
+
+    // nodes are created in another tree, so they aren't seen by the trace of 'src'
+    TREE_TRACE_TOUCH( dest->nodes_count );
 
     return TREE_STATUS_OK;
 }
@@ -276,11 +799,20 @@ TreeStatus tree_copy_subtree_into_left( Tree *dest, TreeNode *dest_node, const T
     assert(dest);
     assert(dest_node);
     assert(src_subtree);
+    TREE_TRACE(dest, COPY_SUBTREE_INTO_LEFT);
 
-    if (dest_node->left)
+    if (tree_node_left(dest_node))
         return TREE_STATUS_WARNING_LEFT_CHILD_IS_OCCUPIED;
 
-    dest_node->left = tree_copy_node(dest, dest_node, src_subtree);
+    if ( !_tree_pers_is_writable( dest, dest_node ) )
+        return TREE_STATUS_WARNING_NODE_IS_SHARED;
+
+    TreeNode *copy = tree_copy_node( dest, dest_node, src_subtree, dest->threads_count );
+    if (!copy)
+        return TREE_STATUS_ERROR_MEM_ALLOC;
+
+    tree_node_set_left( dest_node, copy );
+    _tree_hash_invalidate( dest, dest_node );
 
     return TREE_STATUS_OK;
 }
@@ -290,64 +822,85 @@ TreeStatus tree_copy_subtree_into_right( Tree *dest, TreeNode *dest_node, const
     assert(dest);
     assert(dest_node);
     assert(src_subtree);
+    TREE_TRACE(dest, COPY_SUBTREE_INTO_RIGHT);
 
-    if (dest_node->right)
+    if (tree_node_right(dest_node))
         return TREE_STATUS_WARNING_LEFT_CHILD_IS_OCCUPIED;
 
-    dest_node->right = tree_copy_node(dest, dest_node, src_subtree);
+    if ( !_tree_pers_is_writable( dest, dest_node ) )
+        return TREE_STATUS_WARNING_NODE_IS_SHARED;
+
+    TreeNode *copy = tree_copy_node( dest, dest_node, src_subtree, dest->threads_count );
+    if (!copy)
+        return TREE_STATUS_ERROR_MEM_ALLOC;
+
+    tree_node_set_right( dest_node, copy );
+    _tree_hash_invalidate( dest, dest_node );
 
     return TREE_STATUS_OK;
 }
 
-//! @note Returns 1 if the 'except_node' is in the to be deleted subtree, 0 otherwise.
-inline int del_rec( Tree *tree_ptr, TreeNode *start_with, TreeNode* except_node )
+TreeStatus tree_update_all_tree_levels( Tree *tree_ptr, TreeNode *curr_node, size_t curr_level )
 {
     assert(tree_ptr);
-    assert(start_with);
-    assert(except_node);
+    TREE_TRACE(tree_ptr, UPDATE_ALL_TREE_LEVELS);
 
-    int except_node_found = 0;
+    if (curr_node == NULL)
+    {
+        curr_node = tree_get_root( tree_ptr );
+        if (!curr_node)
+            return TREE_STATUS_OK;
+        curr_level = 0;
+    }
+
+    return relevel_subtree( tree_ptr, curr_node, curr_level );
+}
+
+size_t tree_get_depth( const Tree *tree_ptr )
+{
+    assert(tree_ptr);
 
-    if ( start_with->left && start_with->left != except_node )
-        except_node_found |= del_rec( tree_ptr, start_with->left, except_node );
-    else if ( start_with->left == except_node )
-        except_node_found |= 1;
+    return tree_ptr->depth;
+}
 
-    start_with->left = NULL;
+TreeStatus tree_get_stats( const Tree *tree_ptr, TreeStats *stats )
+{
+    TREE_SELFCHECK(tree_ptr);
+    assert(stats);
 
-    if ( start_with->right && start_with->right != except_node )
-        except_node_found |= del_rec( tree_ptr, start_with->right, except_node );
-    else if ( start_with->right == except_node )
-        except_node_found |= 1;
-    start_with->right = NULL;
+    *stats = {};
+    stats->nodes_count      = tree_ptr->nodes_count;
+    stats->depth            = tree_ptr->depth;
+    stats->data_size        = tree_ptr->data_size;
+    stats->snapshots_count  = tree_ptr->snapshots_count;
 
-    op_del_TreeNode( tree_ptr, start_with );
+    if ( tree_ptr->alloc && _tree_alloc_get_stats( tree_ptr->alloc, &stats->alloc ) != TREE_ALLOC_OK )
+        return TREE_STATUS_ERROR_ALLOC_INIT;
 
-    return except_node_found;
+    return TREE_STATUS_OK;
 }
 
-void tree_update_all_tree_levels( Tree *tree_ptr, TreeNode *curr_node, size_t curr_level )
+//! @brief Returns 1 if migration of 'migr_node' is allowed in persistent mode: links of 'dest_node'
+//! (if not NULL) are changed, and so are links of the old parent of 'migr_node', unless it
+//! is in the subtree 'released' (which is released by the migration, may be NULL).
+inline int migration_is_writable( const Tree *tree_ptr, const TreeNode *dest_node,
+                                  const TreeNode *released, const TreeNode *migr_node )
 {
-    assert(tree_ptr);
+    if ( !tree_ptr->persistent )
+        return 1;
 
-    if (curr_node == NULL)
-    {
-        curr_node = tree_get_root( tree_ptr );
-        if (!curr_node)
-            return;
-        curr_level = 0;
-        tree_ptr->depth = 0;
-    }
+    if ( dest_node && !_tree_pers_is_writable( tree_ptr, dest_node ) )
+        return 0;
 
-    curr_node->level = curr_level;
-    if ( tree_ptr->depth < curr_level )
-        tree_ptr->depth = curr_level;
+    const TreeNode *old_parent = tree_node_parent(migr_node);
+    if ( !old_parent )
+        return 1;
 
-    if ( curr_node->left )
-        tree_update_all_tree_levels( tree_ptr, curr_node->left, curr_level + 1 );
+    for ( const TreeNode *curr = migr_node; curr; curr = tree_node_parent(curr) )
+        if ( curr == released )
+            return 1;
 
-    if ( curr_node->right)
-        tree_update_all_tree_levels( tree_ptr, curr_node->right, curr_level + 1 );
+    return _tree_pers_is_writable( tree_ptr, old_parent );
 }
 
 TreeStatus tree_migrate_into_left( Tree *tree_ptr, TreeNode *dest_node, TreeNode *migr_node )
@@ -355,23 +908,39 @@ TreeStatus tree_migrate_into_left( Tree *tree_ptr, TreeNode *dest_node, TreeNode
     TREE_SELFCHECK(tree_ptr);
     assert(dest_node);
     assert(migr_node);
+    TREE_TRACE(tree_ptr, MIGRATE_INTO_LEFT);
+
+    if (tree_node_left(dest_node) == migr_node)
+        return TREE_STATUS_OK;
+
+    if ( !migration_is_writable( tree_ptr, dest_node, tree_node_left(dest_node), migr_node ) )
+        return TREE_STATUS_WARNING_NODE_IS_SHARED;
+
+    // new link is counted first, so that releasing of the old subtree doesn't free 'migr_node'
+    if ( tree_ptr->persistent )
+        _tree_pers_ref( tree_ptr, migr_node );
 
     int migr_node_found = 0;
-    if (dest_node->left)
-        migr_node_found = del_rec( tree_ptr, dest_node->left, migr_node );
+    if (tree_node_left(dest_node))
+        migr_node_found = release_subtree( tree_ptr, tree_node_left(dest_node), migr_node );
 
-    if (!migr_node_found && migr_node->parent)
+    TreeNode *old_parent = tree_node_parent(migr_node);
+    if (!migr_node_found && old_parent)
     {
-        if      (migr_node->parent->left == migr_node)
-            migr_node->parent->left = NULL;
-        else if (migr_node->parent->right == migr_node)
-            migr_node->parent->right = NULL;
+        if      (tree_node_left(old_parent) == migr_node)
+            tree_node_set_left( old_parent, NULL );
+        else if (tree_node_right(old_parent) == migr_node)
+            tree_node_set_right( old_parent, NULL );
+        _tree_hash_invalidate( tree_ptr, old_parent );
     }
+    if ( !migr_node_found && tree_ptr->persistent )
+        _tree_pers_unref( tree_ptr, migr_node );
 
-    dest_node->left     = migr_node;
-    migr_node->parent   = dest_node;
+    tree_node_set_left( dest_node, migr_node );
+    tree_node_set_parent( migr_node, dest_node );
+    _tree_hash_invalidate( tree_ptr, dest_node );
 
-    tree_update_all_tree_levels( tree_ptr );
+    WRP_RET( relevel_subtree( tree_ptr, migr_node, tree_node_level(dest_node) + 1 ) );
 
     return TREE_STATUS_OK;
 }
@@ -381,23 +950,39 @@ TreeStatus tree_migrate_into_right( Tree *tree_ptr, TreeNode *dest_node, TreeNod
     TREE_SELFCHECK(tree_ptr);
     assert(dest_node);
     assert(migr_node);
+    TREE_TRACE(tree_ptr, MIGRATE_INTO_RIGHT);
+
+    if (tree_node_right(dest_node) == migr_node)
+        return TREE_STATUS_OK;
+
+    if ( !migration_is_writable( tree_ptr, dest_node, tree_node_right(dest_node), migr_node ) )
+        return TREE_STATUS_WARNING_NODE_IS_SHARED;
+
+    // new link is counted first, so that releasing of the old subtree doesn't free 'migr_node'
+    if ( tree_ptr->persistent )
+        _tree_pers_ref( tree_ptr, migr_node );
 
     int migr_node_found = 0;
-    if (dest_node->right)
-        migr_node_found = del_rec( tree_ptr, dest_node->right, migr_node );
+    if (tree_node_right(dest_node))
+        migr_node_found = release_subtree( tree_ptr, tree_node_right(dest_node), migr_node );
 
-    if (!migr_node_found && migr_node->parent)
+    TreeNode *old_parent = tree_node_parent(migr_node);
+    if (!migr_node_found && old_parent)
     {
-        if      (migr_node->parent->left == migr_node)
-            migr_node->parent->left = NULL;
-        else if (migr_node->parent->right == migr_node)
-            migr_node->parent->right = NULL;
+        if      (tree_node_left(old_parent) == migr_node)
+            tree_node_set_left( old_parent, NULL );
+        else if (tree_node_right(old_parent) == migr_node)
+            tree_node_set_right( old_parent, NULL );
+        _tree_hash_invalidate( tree_ptr, old_parent );
     }
+    if ( !migr_node_found && tree_ptr->persistent )
+        _tree_pers_unref( tree_ptr, migr_node );
 
-    dest_node->right    = migr_node;
-    migr_node->parent   = dest_node;
+    tree_node_set_right( dest_node, migr_node );
+    tree_node_set_parent( migr_node, dest_node );
+    _tree_hash_invalidate( tree_ptr, dest_node );
 
-    tree_update_all_tree_levels( tree_ptr );
+    WRP_RET( relevel_subtree( tree_ptr, migr_node, tree_node_level(dest_node) + 1 ) );
 
     return TREE_STATUS_OK;
 }
@@ -406,13 +991,21 @@ TreeStatus tree_migrate_into_root( Tree *tree_ptr, TreeNode *migr_node )
 {
     TREE_SELFCHECK(tree_ptr);
     assert(migr_node);
+    TREE_TRACE(tree_ptr, MIGRATE_INTO_ROOT);
+
+    if (tree_ptr->root == migr_node)
+        return TREE_STATUS_OK;
 
-    del_rec( tree_ptr, tree_get_root(tree_ptr), migr_node );
+    if ( tree_ptr->persistent )
+        _tree_pers_ref( tree_ptr, migr_node );
 
-    migr_node->parent = NULL;
+    if ( !release_subtree( tree_ptr, tree_get_root(tree_ptr), migr_node ) && tree_ptr->persistent )
+        _tree_pers_unref( tree_ptr, migr_node );
+
+    tree_node_set_parent( migr_node, NULL );
     tree_ptr->root = migr_node;
 
-    tree_update_all_tree_levels(tree_ptr);
+    WRP_RET( relevel_subtree( tree_ptr, migr_node, 0 ) );
 
     return TREE_STATUS_OK;
 }
@@ -421,60 +1014,107 @@ TreeStatus tree_delete_subtree( Tree *tree_ptr, TreeNode *subtree )
 {
     TREE_SELFCHECK(tree_ptr);
     assert(subtree);
+    TREE_TRACE(tree_ptr, DELETE_SUBTREE);
 
-    if ( subtree->left )
-    {
-        TreeStatus err = tree_delete_subtree( tree_ptr, subtree->left );
-        if (err)
-            return err;
-    }
-    if ( subtree->right )
+    TreeNode *parent = tree_node_parent(subtree);
+    if ( parent && !_tree_pers_is_writable( tree_ptr, parent ) )
+        return TREE_STATUS_WARNING_NODE_IS_SHARED;
+
+    _tree_hash_invalidate( tree_ptr, parent );
+
+    if      ( parent && tree_node_left(parent) == subtree )
+        tree_node_set_left( parent, NULL );
+    else if ( parent && tree_node_right(parent) == subtree )
+        tree_node_set_right( parent, NULL );
+    else if ( tree_ptr->root == subtree )
+        tree_ptr->root = NULL;
+
+    release_subtree( tree_ptr, subtree, NULL );
+
+    return TREE_STATUS_OK;
+}
+
+TreeStatus tree_clear( Tree *tree_ptr )
+{
+    TREE_SELFCHECK(tree_ptr);
+    TREE_TRACE(tree_ptr, CLEAR);
+
+    if ( tree_ptr->snapshots_count )
     {
-        TreeStatus err = tree_delete_subtree( tree_ptr, subtree->right );
-        if (err)
-            return err;
+        // nodes may be used by snapshots, so memory pools can't be reset
+        // (and loose nodes are left, see tree.h)
+        if ( tree_ptr->root )
+            release_subtree( tree_ptr, tree_ptr->root, NULL );
+        tree_ptr->root = NULL;
+
+        return TREE_STATUS_OK;
     }
 
-    op_del_TreeNode(tree_ptr, subtree);
+    if ( tree_ptr->data_dtor_func_ptr )
+        dtor_all_nodes_data( tree_ptr );
+
+    if ( _tree_alloc_reset( tree_ptr->alloc ) != TREE_ALLOC_OK )
+        return TREE_STATUS_ERROR_ALLOC_INIT;
+
+    tree_ptr->root          = NULL;
+    tree_ptr->nodes_count   = 0;
+    tree_ptr->depth         = 0;
+
+    if ( tree_ptr->level_hist )
+        memset( tree_ptr->level_hist, 0, tree_ptr->level_hist_cap * sizeof(size_t) );
 
     return TREE_STATUS_OK;
 }
 
 TreeStatus tree_hang_loose_node_at_left( Tree *tree_ptr, TreeNode *loose_node, TreeNode *parent_node )
 {
-    if ( parent_node->left )
+    TREE_TRACE(tree_ptr, HANG_LOOSE_NODE_AT_LEFT);
+
+    if ( tree_node_left(parent_node) )
         return TREE_STATUS_WARNING_LEFT_CHILD_IS_OCCUPIED;
 
-    parent_node->left = loose_node;
-    loose_node->parent = parent_node;
+    if ( !_tree_pers_is_writable( tree_ptr, parent_node ) )
+        return TREE_STATUS_WARNING_NODE_IS_SHARED;
 
-    tree_update_all_tree_levels( tree_ptr, loose_node, parent_node->level + 1 );
+    tree_node_set_left( parent_node, loose_node );
+    tree_node_set_parent( loose_node, parent_node );
+    _tree_hash_invalidate( tree_ptr, parent_node );
+
+    WRP_RET( relevel_subtree( tree_ptr, loose_node, tree_node_level(parent_node) + 1 ) );
 
     return TREE_STATUS_OK;
 }
 
 TreeStatus tree_hang_loose_node_at_right( Tree *tree_ptr, TreeNode *loose_node, TreeNode *parent_node )
 {
-    if ( parent_node->right )
+    TREE_TRACE(tree_ptr, HANG_LOOSE_NODE_AT_RIGHT);
+
+    if ( tree_node_right(parent_node) )
         return TREE_STATUS_WARNING_RIGHT_CHILD_IS_OCCUPIED;
 
-    parent_node->right = loose_node;
-    loose_node->parent = parent_node;
+    if ( !_tree_pers_is_writable( tree_ptr, parent_node ) )
+        return TREE_STATUS_WARNING_NODE_IS_SHARED;
+
+    tree_node_set_right( parent_node, loose_node );
+    tree_node_set_parent( loose_node, parent_node );
+    _tree_hash_invalidate( tree_ptr, parent_node );
 
-    tree_update_all_tree_levels( tree_ptr, loose_node, parent_node->level + 1 );
+    WRP_RET( relevel_subtree( tree_ptr, loose_node, tree_node_level(parent_node) + 1 ) );
 
     return TREE_STATUS_OK;
 }
 
 TreeStatus tree_hang_loose_node_as_root( Tree *tree_ptr, TreeNode *loose_node)
 {
+    TREE_TRACE(tree_ptr, HANG_LOOSE_NODE_AS_ROOT);
+
     if ( tree_ptr->root )
         return TREE_STATUS_WARNING_ROOT_ALREADY_EXISTS;
 
     tree_ptr->root = loose_node;
-    loose_node->parent = NULL;
+    tree_node_set_parent( loose_node, NULL );
 
-    tree_update_all_tree_levels( tree_ptr );
+    WRP_RET( relevel_subtree( tree_ptr, loose_node, 0 ) );
 
     return TREE_STATUS_OK;
 }
@@ -484,84 +1124,85 @@ int is_node_leaf( const TreeNode* node_ptr)
 {
     assert(node_ptr);
 
-    return ( !node_ptr->left && !node_ptr->right );
+    return ( !tree_node_left(node_ptr) && !tree_node_right(node_ptr) );
 }
 
-TreeNode *op_new_TreeNode( Tree *tree_ptr, void *data, TreeNode* parent )
+TreeNode *op_new_empty_TreeNode( Tree *tree_ptr, TreeNode* parent )
 {
-    assert(data);
+    assert(tree_ptr);
+
+    if ( level_hist_reserve( tree_ptr, (parent ? tree_node_level(parent) + 1 : 0) ) != TREE_STATUS_OK )
+        return NULL;
 
     //char *new_mem = (char*) calloc( 1, sizeof(TreeNode) + tree_ptr->data_size );
-    char *new_mem = (char*) _tree_alloc_new();
+    char *new_mem = (char*) _tree_alloc_new( tree_ptr->alloc );
     if (!new_mem)
         return NULL;
 
-    memcpy( new_mem + sizeof(TreeNode), data, tree_ptr->data_size );
-
     TreeNode *new_node = (TreeNode *) new_mem;
+#ifndef TREE_COMPACT_NODES
     new_node->data_ptr = (void*) (new_mem + sizeof(TreeNode));
+#endif
 
-#ifdef TREE_DO_DUMP
-    TreeNode *tmp = tree_ptr->head_of_all_nodes;
-    tree_ptr->head_of_all_nodes = new_node;
-    new_node->next = tmp;
-    if (tmp)
-    {
-        tmp->prev = new_node;
-    }
-#endif /* TREE_DO_DUMP */
-
-    new_node->parent = parent;
+    tree_node_set_parent( new_node, parent );
 
     if (parent)
-        new_node->level = parent->level + 1;
+        tree_node_set_level( new_node, tree_node_level(parent) + 1 );
     else
-        new_node->level = 0;
+        tree_node_set_level( new_node, 0 );
 
-    if (tree_ptr->depth < new_node->level)
-        tree_ptr->depth = new_node->level;
+    level_hist_inc( tree_ptr, tree_node_level(new_node) );
 
     tree_ptr->nodes_count++;
 
     return new_node;
 }
 
+TreeNode *op_new_TreeNode( Tree *tree_ptr, void *data, TreeNode* parent )
+{
+    assert(data);
+
+    TreeNode *new_node = op_new_empty_TreeNode( tree_ptr, parent );
+    if (!new_node)
+        return NULL;
+
+    memcpy( tree_node_data(new_node), data, tree_ptr->data_size );
+
+    return new_node;
+}
+
 void op_del_TreeNode( Tree *tree_ptr, TreeNode *node_ptr )
 {
     assert(tree_ptr);
     assert(node_ptr);
 
-    if ( tree_ptr->data_dtor_func_ptr ) tree_ptr->data_dtor_func_ptr( node_ptr->data_ptr );
-
-    if      ( node_ptr->parent && node_ptr->parent->left == node_ptr )
-        node_ptr->parent->left = NULL;
-    else if ( node_ptr->parent && node_ptr->parent->right == node_ptr )
-        node_ptr->parent->right = NULL;
+    if ( tree_ptr->data_dtor_func_ptr ) tree_ptr->data_dtor_func_ptr( tree_node_data(node_ptr) );
 
-    node_ptr->left      = NULL;
-    node_ptr->right     = NULL;
-    node_ptr->data_ptr  = NULL;
-    node_ptr->parent    = NULL;
+    TreeNode *parent = tree_node_parent(node_ptr);
+    if      ( parent && tree_node_left(parent) == node_ptr )
+        tree_node_set_left( parent, NULL );
+    else if ( parent && tree_node_right(parent) == node_ptr )
+        tree_node_set_right( parent, NULL );
+    _tree_hash_invalidate( tree_ptr, parent );
 
-#ifdef TREE_DO_DUMP
-    TreeNode *next = node_ptr->next;
-    TreeNode *prev = node_ptr->prev;
-    if (next)
-        next->prev = prev;
-    if (prev)
-        prev->next = next;
-
-    if (!prev)
+    if ( tree_ptr->persistent )
     {
-       tree_ptr->head_of_all_nodes = next;
+        // node may be used by snapshots, so its fields are kept
+        release_subtree( tree_ptr, node_ptr, NULL );
+        return;
     }
-    
-    node_ptr->next = NULL;
-    node_ptr->prev = NULL;
-#endif /* TREE_DO_DUMP */
+
+    tree_node_set_left( node_ptr, NULL );
+    tree_node_set_right( node_ptr, NULL );
+    tree_node_set_parent( node_ptr, NULL );
+#ifndef TREE_COMPACT_NODES
+    node_ptr->data_ptr  = NULL;
+#endif
+
+    level_hist_dec( tree_ptr, tree_node_level(node_ptr) );
 
     //free(node_ptr);
-    _tree_alloc_del( node_ptr );
+    _tree_alloc_del( tree_ptr->alloc, node_ptr );
 
     tree_ptr->nodes_count--;
 }
@@ -3,6 +3,14 @@
 
 #include "tree_common.h"
 #include "tree_dump.h"
+#include "tree_iter.h"
+#include "tree_io.h"
+#include "tree_persist.h"
+#include "tree_dag.h"
+#include "tree_hash.h"
+#include "tree_export.h"
+#include "tree_trace.h"
+#include "tree_layout.h"
 
 TreeStatus tree_ctor_( Tree *tree_ptr,
                        size_t data_size_in_bytes,
@@ -47,6 +55,23 @@ TreeStatus tree_ctor_( Tree *tree_ptr,
 
 TreeStatus tree_dtor( Tree *tree_ptr );
 
+//! @brief Sets the maximum number of nodes in one memory pool of the tree.
+//! @details When all memory pools are full, a new one, twice as big as the last one,
+//! is created, but it can't be bigger than 'max_mem_pool_size' (unless
+//! 'typical_num_of_nodes' given to tree_ctor() is already bigger).
+//! By default equals TREE_DEFAULT_MAX_MEM_POOL_SIZE.
+TreeStatus tree_set_max_mem_pool_size( Tree *tree_ptr, size_t max_mem_pool_size );
+
+//! @brief Sets the max number of threads, used by parallel operations over the tree:
+//! tree_copy() (if the tree is the source), tree_copy_subtree_into_*() (if the tree
+//! is the destination), tree_par_fold() and tree_par_reduce() (see tree_visit.h).
+//! 0 means the number of hardware threads. By default equals 1,
+//! so nothing is done in parallel.
+//! @note Parallel copy gives the same tree as the sequential one, but the order
+//! of nodes in memory differs. Subtrees of less than 2^14 nodes are always
+//! copied in one thread, as starting threads takes longer.
+TreeStatus tree_set_threads_count( Tree *tree_ptr, size_t threads_count );
+
 
 //! @brief Inserts data into the empty tree as a new node. The new node becomes the root node.
 //! @param [in] tree_ptr Tree pointer.
@@ -98,6 +123,7 @@ TreeStatus tree_delete_left_child( Tree *tree_ptr, TreeNode *node_ptr );
 TreeStatus tree_delete_right_child( Tree *tree_ptr, TreeNode *node_ptr );
 
 //! @brief Makes full copy of given tree 'source' and puts it by 'dest' pointer.
+//! @note If error happens, 'dest' is left destructed (no need to call tree_dtor() for it).
 TreeStatus tree_copy( Tree *dest, const Tree *source );
 
 //! @brief Copies full subtree, in which 'src_subtree' plays role of the root,
@@ -125,8 +151,19 @@ TreeStatus tree_migrate_into_right( Tree *tree_ptr, TreeNode *dest_node, TreeNod
 //! @brief The whole tree is replaced with the subtree, which starts with 'migr_node'.
 TreeStatus tree_migrate_into_root( Tree *tree_ptr, TreeNode *migr_node );
 
+//! @brief Deletes the whole subtree, in which 'subtree' plays role of the root,
+//! in one pass, and unlinks it from its parent.
 TreeStatus tree_delete_subtree( Tree *tree_ptr, TreeNode *subtree );
 
+//! @brief Deletes all nodes of the tree (including loose ones), but keeps
+//! its memory pools for the nodes to be inserted later.
+//! @note If the tree has no 'data_dtor_func_ptr', takes time proportional
+//! to the number of memory pools, not nodes.
+//! @attention If the tree has snapshots, only nodes, reachable from the root, are
+//! released (and freed, if no snapshot uses them). Loose nodes can't be told from
+//! roots of snapshots then, so they stay and must be deleted by op_del_TreeNode().
+TreeStatus tree_clear( Tree *tree_ptr );
+
 //! @brief Hangs specified 'loose_node' as the left child of the 'parent_node'.
 //! @note ATTENTION: 'loose_node' must be created using 'op_new_TreeNode' for the same tree
 //! and it mustn't be a child of any other node in the tree!
@@ -142,11 +179,30 @@ TreeStatus tree_hang_loose_node_at_right( Tree *tree_ptr, TreeNode *loose_node,
 //! and it mustn't be a child of any other node in the tree!
 TreeStatus tree_hang_loose_node_as_root( Tree *tree_ptr, TreeNode *loose_node);
 
-void tree_update_all_tree_levels( Tree *tree_ptr, TreeNode *curr_node = NULL, size_t curr_level = 0 );
+//! @brief Sets level of 'curr_node' to 'curr_level' and updates levels of all nodes of its
+//! subtree accordingly (if 'curr_node' is NULL, the root and level 0 are used).
+//! @note Levels and depth are kept up to date by all other functions, which touch
+//! only moved subtrees, so there is usually no need to call this one.
+TreeStatus tree_update_all_tree_levels( Tree *tree_ptr, TreeNode *curr_node = NULL, size_t curr_level = 0 );
+
+//! @brief Returns max level of all nodes of the tree.
+//! @note Is exact after any insertions, deletions and migrations.
+size_t tree_get_depth( const Tree *tree_ptr );
+
+//! @brief Writes statistics of the tree and of its allocator into 'stats'
+//! (see TreeStats and TreeAllocStats). Takes time proportional to the number
+//! of memory pools, not nodes, so can be called often (e.g. for monitoring).
+//! @note Peak number of live blocks is a good 'typical_num_of_nodes' for tree_ctor().
+TreeStatus tree_get_stats( const Tree *tree_ptr, TreeStats *stats );
 
 //! @note ATTENTION: USE ONLY IF YOU DO KNOW WHAT YOU ARE DOING!
 TreeNode *op_new_TreeNode( Tree *tree_ptr, void *data, TreeNode* parent = NULL);
 
+//! @brief Same as op_new_TreeNode(), but data of the new node is left
+//! zero-filled, so that it can be constructed in place.
+//! @note ATTENTION: USE ONLY IF YOU DO KNOW WHAT YOU ARE DOING!
+TreeNode *op_new_empty_TreeNode( Tree *tree_ptr, TreeNode* parent = NULL);
+
 //! @note ATTENTION: USE ONLY IF YOU DO KNOW WHAT YOU ARE DOING!
 void op_del_TreeNode( Tree *tree_ptr, TreeNode *node_ptr );
 
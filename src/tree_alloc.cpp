@@ -1,171 +1,956 @@
 #include <stdlib.h>
 #include <memory.h>
 #include <assert.h>
+#include <pthread.h>
+
+#ifdef TREE_COMPACT_NODES
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 #include "tree_alloc.h"
 
 
 typedef unsigned char byte;
+
+static_assert( sizeof(TreeNode) % TREE_DATA_ALIGN == 0 && sizeof(size_t) == TREE_DATA_ALIGN,
+               "blocks must keep data of nodes aligned by TREE_DATA_ALIGN" );
+
+//! @brief Is used as 'next_free_pool' or 'free_pools_head'
+//! value, meaning that there is no such memory pool.
+const size_t NO_FREE_POOL = SIZE_MAX;
+
 struct MemPool
 {
     // array of bytes, associated with this mempool
     byte *mempool = NULL;
 
+    //! @attention Size of this mem pool in BLOCKS, NOT BYTES!
+    size_t size = 0;
+
     // index of the first elem in the linked list of free elems of the pool
-    //! @note If free_elem_ind == MEM_POOLS_SIZE,
+    //! @note If free_elem_ind == size, the list is empty.
+    size_t free_elem_ind = 0;
+
+    //! @brief Blocks with indexes [used_size, size) have never been
+    //! given away, so they are not linked into the list of free elems.
+    //! @note If free_elem_ind == size and used_size == size,
     //! it means that this memory pool is full.
-    size_t free_elem_ind;
-};
+    size_t used_size = 0;
 
+    //! @brief Number of blocks of this pool, which are given away now.
+    size_t live_count = 0;
 
-//! @brief Size of one block ( sizeof(TreeNode) + tree_ptr->data_size ).
-static size_t BLOCK_SIZE = 0;
+    // id of the next memory pool in the list of pools, having free blocks
+    size_t next_free_pool = NO_FREE_POOL;
 
-//! @attention Size of one MEM_POOL in BLOCKS, NOT BYTES!
-static size_t MEM_POOL_SIZE = 0;
+    //! @brief If true, the pool is being emptied by compaction (see
+    //! _tree_alloc_compact_begin()), so it is never put into the list of free pools.
+    bool evacuated = false;
 
-//! @brief Array of memory pools, each of size set
-//! during initialization. New memory pools are
-//! allocated when all previous are full.
-//! @note It is supposed that there is only one memory pool,
-//! and only in some extraordinary cases there might be created
-//! the second or the third one.
-static MemPool *MEM_POOLS = NULL;
+    //! @brief Bit i is set if block i is given away. Only bits of blocks
+    //! with indexes [0, used_size) are meaningful, so the bitmap is not cleared,
+    //! when the pool is reset: every block below used_size was given away since then.
+    uint64_t *live_bits = NULL;
 
-//! @brief Current count of allocated memory pools.
-static size_t MEM_POOLS_COUNT = 0;
+    //! @brief Reference counters of blocks of this pool (side table, so that
+    //! blocks don't grow), NULL unless _tree_alloc_enable_refs() is called.
+    uint32_t *refs = NULL;
 
+    //! @brief Cached hashes of subtrees, rooted at blocks of this pool (0 means
+    //! there is no hash), NULL unless _tree_alloc_enable_hashes() is called.
+    size_t *hashes = NULL;
+};
 
+//! @brief Allocator context. Each tree owns exactly one,
+//! so nothing here is shared between trees.
+struct TreeAlloc
+{
+    //! @brief Size of one block ( sizeof(TreeNode) + tree_ptr->data_size ).
+    size_t block_size = 0;
+
+    //! @brief Size of the first mem pool in BLOCKS, NOT BYTES!
+    //! Every next mem pool is twice as big as the previous one,
+    //! but not bigger than 'max_mem_pool_size'.
+    size_t mem_pool_size = 0;
+
+    //! @attention In BLOCKS, NOT BYTES!
+    size_t max_mem_pool_size = 0;
+
+    //! @brief Array of memory pools. New memory pools are
+    //! allocated when all previous are full.
+    MemPool *mem_pools = NULL;
+
+    //! @brief Current count of allocated memory pools.
+    size_t mem_pools_count = 0;
+
+    //! @brief Number of elements 'mem_pools' has space for.
+    size_t mem_pools_capacity = 0;
+
+    //! @brief Id of the first memory pool in the list of pools,
+    //! having at least one free block. New blocks are always taken
+    //! from this pool, so there is no need to search for a free one.
+    size_t free_pools_head = NO_FREE_POOL;
+
+    //! @brief If true, every memory pool has a table of reference counters.
+    bool refs_enabled = false;
+
+    //! @brief If true, every memory pool has a table of cached hashes.
+    bool hashes_enabled = false;
+
+    // counters for _tree_alloc_get_stats(), see TreeAllocStats
+    size_t allocs_count         = 0;
+    size_t frees_count          = 0;
+    size_t failed_allocs_count  = 0;
+    size_t live_blocks          = 0;
+    size_t peak_live_blocks     = 0;
+
+#ifdef TREE_COMPACT_NODES
+    //! @brief Reserved address range of TREE_COMPACT_REGION_SIZE bytes.
+    //! Memory pools are cut from it and kept sorted, so addresses of memory
+    //! pools grow with their ids. Ranges of released pools are cut again.
+    byte *region = NULL;
+#endif
+
+    //! @brief If true, all operations with memory pools are done under 'mutex',
+    //! see _tree_alloc_set_concurrent().
+    bool concurrent = false;
+    pthread_mutex_t mutex;
+};
 
-#define ACCESS_FREE_MEM_BLOCK(mem_pool_id__, anchor__)  \
-( *((size_t *) (MEM_POOLS[mem_pool_id__].mempool + anchor__*BLOCK_SIZE)) )
 
 
+#define ACCESS_FREE_MEM_BLOCK(alloc__, mem_pool_id__, anchor__)  \
+( *((size_t *) ((alloc__)->mem_pools[mem_pool_id__].mempool + (anchor__)*(alloc__)->block_size)) )
+
+const size_t LIVE_WORD_BITS = 64;
+
+
+
+inline void lock_alloc( TreeAlloc *alloc )
+{
+    if ( alloc->concurrent )
+        pthread_mutex_lock( &alloc->mutex );
+}
+
+inline void unlock_alloc( TreeAlloc *alloc )
+{
+    if ( alloc->concurrent )
+        pthread_mutex_unlock( &alloc->mutex );
+}
 
 //! @returns true if memory pool with given id doesn't
 //! have any free space, false otherwise.
-inline bool is_mempool_full( size_t mem_pool_id )
+inline bool is_mempool_full( const TreeAlloc *alloc, size_t mem_pool_id )
+{
+    const MemPool *pool = &alloc->mem_pools[mem_pool_id];
+
+    return ( pool->free_elem_ind == pool->size && pool->used_size == pool->size );
+}
+
+//! @brief Marks all blocks of given memory pool as free.
+//! @note Blocks are not linked, they are given away one by one
+//! from the never used tail, so it takes O(1).
+inline void init_mem_pool( TreeAlloc *alloc, size_t mem_pool_id )
+{
+    assert(alloc);
+    assert(mem_pool_id < alloc->mem_pools_count);
+
+    alloc->mem_pools[mem_pool_id].free_elem_ind = alloc->mem_pools[mem_pool_id].size;
+    alloc->mem_pools[mem_pool_id].used_size     = 0;
+    alloc->mem_pools[mem_pool_id].live_count    = 0;
+}
+
+//! @brief Finds id of the memory pool, where given node_ptr is located,
+//! and its index (anchor) in this memory pool.
+inline void locate_block( const TreeAlloc *alloc, const TreeNode *node_ptr,
+                          size_t *mem_pool_id_ptr, size_t *anchor_ptr )
+{
+    assert(alloc);
+    assert(node_ptr);
+
+#ifdef TREE_COMPACT_NODES
+    const byte *addr = (const byte *) node_ptr;
+
+    size_t left  = 0;
+    size_t right = alloc->mem_pools_count;
+    while ( right - left > 1 )
+    {
+        size_t mid = left + (right - left) / 2;
+        if ( alloc->mem_pools[mid].mempool <= addr )
+            left = mid;
+        else
+            right = mid;
+    }
+
+    *mem_pool_id_ptr = left;
+    *anchor_ptr      = (size_t) (addr - alloc->mem_pools[left].mempool) / alloc->block_size;
+#else /* NOT TREE_COMPACT_NODES */
+    (void) alloc;
+
+    *mem_pool_id_ptr = node_ptr->mem_pool_id;
+    *anchor_ptr      = node_ptr->mem_pool_anchor;
+#endif /* TREE_COMPACT_NODES */
+}
+
+inline void push_free_pool( TreeAlloc *alloc, size_t mem_pool_id )
 {
-    return ( MEM_POOLS[mem_pool_id].free_elem_ind == MEM_POOL_SIZE );
+    alloc->mem_pools[mem_pool_id].next_free_pool = alloc->free_pools_head;
+    alloc->free_pools_head = mem_pool_id;
 }
 
-//! @brief links all blocks of given memory pool, sets corresponding
-//! memory pool tail.
-inline void init_mem_pool( size_t mem_pool_id )
+//! @brief Returns size (in blocks) for the next memory pool to be created.
+inline size_t next_mem_pool_size( const TreeAlloc *alloc )
 {
-    assert(mem_pool_id < MEM_POOLS_COUNT);
+    if ( alloc->mem_pools_count == 0 )
+        return alloc->mem_pool_size;
 
-    for (size_t ind = 0; ind < MEM_POOL_SIZE; ind++)
+    size_t prev_size = alloc->mem_pools[alloc->mem_pools_count - 1].size;
+    size_t new_size  = prev_size * 2;
+
+    if ( new_size > alloc->max_mem_pool_size )
+        new_size = ( alloc->max_mem_pool_size > prev_size ? alloc->max_mem_pool_size : prev_size );
+
+    return new_size;
+}
+
+#ifdef TREE_COMPACT_NODES
+//! @brief Returns the end of the memory pool (or the start of the region if 'mem_pool_id' is NO_FREE_POOL).
+inline byte *mem_pool_end( const TreeAlloc *alloc, size_t mem_pool_id )
+{
+    if ( mem_pool_id == NO_FREE_POOL )
+        return alloc->region;
+
+    return alloc->mem_pools[mem_pool_id].mempool + alloc->mem_pools[mem_pool_id].size * alloc->block_size;
+}
+
+//! @brief Finds the first free range of the region, which can hold 'size' blocks: a range
+//! of released pools between others or the tail of the region after the last pool.
+//! Id of the pool, to be cut from it, is written by 'new_id_ptr'.
+//! @return Start of the range, or NULL if there is no such one.
+inline byte *find_region_range( const TreeAlloc *alloc, size_t size, size_t *new_id_ptr )
+{
+    for (size_t mem_pool_id = 0; mem_pool_id <= alloc->mem_pools_count; mem_pool_id++)
     {
-        ACCESS_FREE_MEM_BLOCK(mem_pool_id, ind) = ind + 1;
+        byte *range_start = mem_pool_end( alloc, mem_pool_id ? mem_pool_id - 1 : NO_FREE_POOL );
+        byte *range_end   = ( mem_pool_id < alloc->mem_pools_count ? alloc->mem_pools[mem_pool_id].mempool
+                                                                   : alloc->region + TREE_COMPACT_REGION_SIZE );
+
+        if ( (size_t) (range_end - range_start) / alloc->block_size >= size )
+        {
+            *new_id_ptr = mem_pool_id;
+            return range_start;
+        }
     }
 
-    MEM_POOLS[mem_pool_id].free_elem_ind = 0;
+    return NULL;
+}
+#endif /* TREE_COMPACT_NODES */
+
+//! @brief Allocates new memory pool of 'new_size' blocks and puts it into the list of free pools.
+inline TreeAllocRes add_mem_pool( TreeAlloc *alloc, size_t new_size )
+{
+    assert(alloc);
+
+    if ( alloc->mem_pools_count == alloc->mem_pools_capacity )
+    {
+        size_t new_capacity = ( alloc->mem_pools_capacity == 0 ? 4 : alloc->mem_pools_capacity * 2 );
+
+        MemPool* new_mem_pools = (MemPool*) realloc( alloc->mem_pools, new_capacity*sizeof(MemPool) );
+        if (!new_mem_pools) return TREE_ALLOC_ERR_CANT_ALLOC_MEM;
+
+        alloc->mem_pools            = new_mem_pools;
+        alloc->mem_pools_capacity   = new_capacity;
+    }
+
+    size_t new_id = alloc->mem_pools_count;
+
+#ifdef TREE_COMPACT_NODES
+    // pages of the region are zeroed and committed by the OS on the first touch
+    // (pages of released pools - again after madvise(), see release_mem_pool())
+    byte *new_mempool = find_region_range( alloc, new_size, &new_id );
+    if ( !new_mempool )
+    {
+        // the pool is cut to fit into the tail of the region
+        new_mempool = mem_pool_end( alloc, alloc->mem_pools_count ? alloc->mem_pools_count - 1 : NO_FREE_POOL );
+        new_size    = (size_t) ( alloc->region + TREE_COMPACT_REGION_SIZE - new_mempool ) / alloc->block_size;
+        if ( new_size == 0 ) return TREE_ALLOC_ERR_CANT_ALLOC_MEM;
+    }
+#else /* NOT TREE_COMPACT_NODES */
+    byte *new_mempool = (byte *) calloc( new_size, alloc->block_size );
+    if ( !new_mempool ) return TREE_ALLOC_ERR_CANT_ALLOC_MEM;
+#endif /* TREE_COMPACT_NODES */
+
+    uint64_t *new_live  = (uint64_t *) calloc( (new_size + LIVE_WORD_BITS - 1) / LIVE_WORD_BITS, sizeof(uint64_t) );
+    uint32_t *new_refs  = ( alloc->refs_enabled   ? (uint32_t *) calloc( new_size, sizeof(uint32_t) ) : NULL );
+    size_t *new_hashes  = ( alloc->hashes_enabled ? (size_t *)   calloc( new_size, sizeof(size_t) )   : NULL );
+    if ( !new_live || ( alloc->refs_enabled && !new_refs ) || ( alloc->hashes_enabled && !new_hashes ) )
+    {
+        free( new_live );
+        free( new_refs );
+        free( new_hashes );
+#ifndef TREE_COMPACT_NODES
+        free( new_mempool );
+#endif
+        return TREE_ALLOC_ERR_CANT_ALLOC_MEM;
+    }
+
+    if ( new_id < alloc->mem_pools_count )
+    {
+        // pools stay sorted by addresses, so the next ones are shifted (ids in the list of free pools too)
+        memmove( &alloc->mem_pools[new_id + 1], &alloc->mem_pools[new_id],
+                 ( alloc->mem_pools_count - new_id ) * sizeof(MemPool) );
+
+        for (size_t mem_pool_id = 0; mem_pool_id <= alloc->mem_pools_count; mem_pool_id++)
+        {
+            size_t *next = &alloc->mem_pools[mem_pool_id].next_free_pool;
+            if ( mem_pool_id != new_id && *next != NO_FREE_POOL && *next >= new_id )
+                (*next)++;
+        }
+        if ( alloc->free_pools_head != NO_FREE_POOL && alloc->free_pools_head >= new_id )
+            alloc->free_pools_head++;
+    }
+
+    alloc->mem_pools[new_id] = {};
+    alloc->mem_pools[new_id].mempool    = new_mempool;
+    alloc->mem_pools[new_id].size       = new_size;
+    alloc->mem_pools[new_id].live_bits  = new_live;
+    alloc->mem_pools[new_id].refs       = new_refs;
+    alloc->mem_pools[new_id].hashes     = new_hashes;
+    alloc->mem_pools_count++;
+
+    init_mem_pool( alloc, new_id );
+    push_free_pool( alloc, new_id );
+
+    return TREE_ALLOC_OK;
 }
 
-TreeAllocRes _tree_alloc_init( size_t tree_node_with_data_size, size_t mem_pool_size )
+TreeAllocRes _tree_alloc_init(  TreeAlloc **alloc_ptr,
+                                size_t tree_node_with_data_size,
+                                size_t mem_pool_size,
+                                size_t max_mem_pool_size )
 {
+    assert(alloc_ptr);
+
     if ( mem_pool_size == 0 ) return TREE_ALLOC_WRONG_MEM_POOL_SIZE_TO_INIT;
-    if ( MEM_POOLS_COUNT > 0 ) return TREE_ALLOC_ERR_ALREADY_INITED;
 
-    MEM_POOLS = (MemPool*) calloc( 1, sizeof(MemPool) );
-    if ( MEM_POOLS == NULL ) return TREE_ALLOC_ERR_CANT_ALLOC_MEM;
+    TreeAlloc *alloc = (TreeAlloc*) calloc( 1, sizeof(TreeAlloc) );
+    if ( alloc == NULL ) return TREE_ALLOC_ERR_CANT_ALLOC_MEM;
 
     // we are going to store size_t in free blocks, so we should align it with some 'filling'
     size_t mod = tree_node_with_data_size % sizeof(size_t);
     size_t filling = (mod == 0 ? 0 : sizeof(size_t) - mod);
 
-    BLOCK_SIZE = tree_node_with_data_size + filling;
-    MEM_POOL_SIZE = mem_pool_size;
+    alloc->block_size           = tree_node_with_data_size + filling;
+    alloc->mem_pool_size        = mem_pool_size;
+    alloc->max_mem_pool_size    = max_mem_pool_size;
+    alloc->free_pools_head      = NO_FREE_POOL;
+    alloc->refs_enabled         = false;
+    alloc->hashes_enabled       = false;
+    alloc->concurrent           = false;
+    pthread_mutex_init( &alloc->mutex, NULL );
+
+#ifdef TREE_COMPACT_NODES
+    void *region = mmap( NULL, TREE_COMPACT_REGION_SIZE, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0 );
+    if ( region == MAP_FAILED )
+    {
+        pthread_mutex_destroy( &alloc->mutex );
+        free(alloc);
+        return TREE_ALLOC_ERR_CANT_ALLOC_MEM;
+    }
+    alloc->region = (byte *) region;
+#endif
+
+    TreeAllocRes res = add_mem_pool( alloc, next_mem_pool_size( alloc ) );
+    if ( res != TREE_ALLOC_OK )
+    {
+#ifdef TREE_COMPACT_NODES
+        munmap( alloc->region, TREE_COMPACT_REGION_SIZE );
+#endif
+        pthread_mutex_destroy( &alloc->mutex );
+        free(alloc->mem_pools);
+        free(alloc);
+        return res;
+    }
+
+    *alloc_ptr = alloc;
 
-    MEM_POOLS[0].mempool = (byte *) calloc( MEM_POOL_SIZE, BLOCK_SIZE );
+    return TREE_ALLOC_OK;
+}
 
-    if ( MEM_POOLS[0].mempool == NULL )
+TreeAllocRes _tree_alloc_set_max_mem_pool_size( TreeAlloc *alloc, size_t max_mem_pool_size )
+{
+    if ( !alloc ) return TREE_ALLOC_ERR_NOT_INITED;
+    if ( max_mem_pool_size == 0 ) return TREE_ALLOC_WRONG_MEM_POOL_SIZE_TO_INIT;
+
+    lock_alloc( alloc );
+    alloc->max_mem_pool_size = max_mem_pool_size;
+    unlock_alloc( alloc );
+
+    return TREE_ALLOC_OK;
+}
+
+//! @brief _tree_alloc_new() without locking.
+inline void *alloc_new( TreeAlloc *alloc )
+{
+    if ( alloc->free_pools_head == NO_FREE_POOL
+      && add_mem_pool( alloc, next_mem_pool_size( alloc ) ) != TREE_ALLOC_OK )
     {
-        free(MEM_POOLS);
-        return TREE_ALLOC_ERR_CANT_ALLOC_MEM;
+        alloc->failed_allocs_count++;
+        return NULL;
     }
 
-    MEM_POOLS_COUNT++;
+    size_t free_mem_pool_id = alloc->free_pools_head;
+    MemPool *pool = &alloc->mem_pools[ free_mem_pool_id ];
+
+    size_t old_free_ptr = pool->free_elem_ind;
+    if ( old_free_ptr != pool->size )
+        pool->free_elem_ind = ACCESS_FREE_MEM_BLOCK( alloc, free_mem_pool_id, old_free_ptr );
+    else
+        old_free_ptr = pool->used_size++;
+
+    if ( is_mempool_full( alloc, free_mem_pool_id ) )
+    {
+        // pool became full, it is always the head of the list
+        alloc->free_pools_head = pool->next_free_pool;
+        pool->next_free_pool   = NO_FREE_POOL;
+    }
+
+    void *new_mem_block_ptr = &ACCESS_FREE_MEM_BLOCK( alloc, free_mem_pool_id, old_free_ptr );
+    memset( new_mem_block_ptr, 0, alloc->block_size );
+
+#ifndef TREE_COMPACT_NODES
+    ((TreeNode *) new_mem_block_ptr)->mem_pool_id = free_mem_pool_id;
+    ((TreeNode *) new_mem_block_ptr)->mem_pool_anchor = old_free_ptr;
+#endif
+
+    pool->live_bits[old_free_ptr / LIVE_WORD_BITS] |= (uint64_t) 1 << (old_free_ptr % LIVE_WORD_BITS);
+    pool->live_count++;
+
+    alloc->allocs_count++;
+    if ( ++alloc->live_blocks > alloc->peak_live_blocks )
+        alloc->peak_live_blocks = alloc->live_blocks;
+
+    if ( pool->refs )
+        pool->refs[old_free_ptr] = 1;
+    if ( pool->hashes )
+        pool->hashes[old_free_ptr] = 0;
+
+    return new_mem_block_ptr;
+}
+
+//! @brief _tree_alloc_del() without locking.
+inline void alloc_del( TreeAlloc *alloc, TreeNode *node_ptr )
+{
+    size_t mem_pool_id      = 0;
+    size_t mem_pool_anchor  = 0;
+    locate_block( alloc, node_ptr, &mem_pool_id, &mem_pool_anchor );
+
+    assert(mem_pool_id < alloc->mem_pools_count);
+
+    if ( is_mempool_full( alloc, mem_pool_id ) && !alloc->mem_pools[ mem_pool_id ].evacuated )
+        push_free_pool( alloc, mem_pool_id );
+
+    uint64_t *live_word = &alloc->mem_pools[ mem_pool_id ].live_bits[ mem_pool_anchor / LIVE_WORD_BITS ];
+    assert( *live_word & ( (uint64_t) 1 << (mem_pool_anchor % LIVE_WORD_BITS) ) );
+    *live_word &= ~( (uint64_t) 1 << (mem_pool_anchor % LIVE_WORD_BITS) );
+    alloc->mem_pools[ mem_pool_id ].live_count--;
 
-    init_mem_pool( 0 );
+    alloc->frees_count++;
+    alloc->live_blocks--;
+
+    size_t old_free = alloc->mem_pools[ mem_pool_id ].free_elem_ind;
+    ACCESS_FREE_MEM_BLOCK( alloc, mem_pool_id, mem_pool_anchor ) = old_free;
+    alloc->mem_pools[ mem_pool_id ].free_elem_ind = mem_pool_anchor;
+}
+
+void* _tree_alloc_new( TreeAlloc *alloc )
+{
+    if ( !alloc ) return NULL;
+
+    lock_alloc( alloc );
+    void *new_mem_block_ptr = ( alloc->mem_pools_count ? alloc_new( alloc ) : NULL );
+    unlock_alloc( alloc );
+
+    return new_mem_block_ptr;
+}
+
+TreeAllocRes _tree_alloc_del( TreeAlloc *alloc, TreeNode *node_ptr )
+{
+    assert(node_ptr);
+
+    if ( !alloc ) return TREE_ALLOC_ERR_NOT_INITED;
+
+    lock_alloc( alloc );
+    alloc_del( alloc, node_ptr );
+    unlock_alloc( alloc );
+
+    return TREE_ALLOC_OK;
+}
+
+TreeAllocRes _tree_alloc_reset( TreeAlloc *alloc )
+{
+    if ( !alloc || alloc->mem_pools_count == 0 ) return TREE_ALLOC_ERR_NOT_INITED;
+
+    lock_alloc( alloc );
+
+    alloc->free_pools_head = NO_FREE_POOL;
+
+    alloc->frees_count += alloc->live_blocks;
+    alloc->live_blocks  = 0;
+
+    // pushing in reverse order, so that blocks are given away starting from the first pool
+    for (size_t mem_pool_id = alloc->mem_pools_count; mem_pool_id > 0; mem_pool_id--)
+    {
+        init_mem_pool( alloc, mem_pool_id - 1 );
+        push_free_pool( alloc, mem_pool_id - 1 );
+    }
+
+    unlock_alloc( alloc );
 
     return TREE_ALLOC_OK;
 }
 
-void* _tree_alloc_new()
+TreeAllocRes _tree_alloc_get_stats( TreeAlloc *alloc, TreeAllocStats *stats )
 {
-    if ( MEM_POOLS_COUNT == 0 ) return NULL;
+    assert(stats);
+
+    if ( !alloc ) return TREE_ALLOC_ERR_NOT_INITED;
+
+    lock_alloc( alloc );
 
-    bool all_memory_pools_full = true;
-    size_t free_mem_pool_id = 0;
-    for ( ; free_mem_pool_id < MEM_POOLS_COUNT; free_mem_pool_id++ )
+    *stats = {};
+    stats->block_size           = alloc->block_size;
+    stats->mem_pools_count      = alloc->mem_pools_count;
+    stats->allocs_count         = alloc->allocs_count;
+    stats->frees_count          = alloc->frees_count;
+    stats->failed_allocs_count  = alloc->failed_allocs_count;
+    stats->live_blocks          = alloc->live_blocks;
+    stats->peak_live_blocks     = alloc->peak_live_blocks;
+    stats->used_bytes           = alloc->live_blocks * alloc->block_size;
+    stats->reserved_bytes       = alloc->mem_pools_capacity * sizeof(MemPool);
+
+    size_t side_bytes_per_block = ( alloc->refs_enabled   ? sizeof(uint32_t) : 0 )
+                                + ( alloc->hashes_enabled ? sizeof(size_t)   : 0 );
+
+    for (size_t mem_pool_id = 0; mem_pool_id < alloc->mem_pools_count; mem_pool_id++)
     {
-        if ( !is_mempool_full(free_mem_pool_id) )
+        const MemPool *pool = &alloc->mem_pools[mem_pool_id];
+
+        stats->reserved_blocks  += pool->size;
+        stats->touched_blocks   += pool->used_size;
+        stats->free_list_blocks += pool->used_size - pool->live_count;
+        stats->reserved_bytes   += pool->size * ( alloc->block_size + side_bytes_per_block )
+                                 + (pool->size + LIVE_WORD_BITS - 1) / LIVE_WORD_BITS * sizeof(uint64_t);
+
+        if ( pool->live_count == 0 )
         {
-            all_memory_pools_full = false;
-            break;
+            stats->empty_pools_count++;
+            continue;
         }
+
+        // ceil( live_count * N / size ) - 1, so that full pools get into the last bucket
+        size_t bucket = ( pool->live_count * TREE_ALLOC_OCCUPANCY_BUCKETS + pool->size - 1 ) / pool->size - 1;
+        stats->pools_by_occupancy[bucket]++;
     }
 
-    //if (all_memory_pools_full) ; // TODO - create new memory pool
-    // set free_mem_pool_id to id of the new mem pool
-    if ( all_memory_pools_full ) 
+    unlock_alloc( alloc );
+
+    return TREE_ALLOC_OK;
+}
+
+TreeAllocRes _tree_alloc_set_concurrent( TreeAlloc *alloc, bool concurrent )
+{
+    if ( !alloc ) return TREE_ALLOC_ERR_NOT_INITED;
+
+    alloc->concurrent = concurrent;
+
+    return TREE_ALLOC_OK;
+}
+
+//! @brief Allocates the side table 'table' (zero-filled) for every memory pool, which
+//! doesn't have it yet, and sets 'enabled'. Tables, allocated before an error, are kept.
+template <typename T>
+inline TreeAllocRes enable_side_table( TreeAlloc *alloc, T *MemPool::*table, bool *enabled )
+{
+    lock_alloc( alloc );
+
+    TreeAllocRes res = TREE_ALLOC_OK;
+    for (size_t mem_pool_id = 0; mem_pool_id < alloc->mem_pools_count && !*enabled; mem_pool_id++)
     {
-        MemPool* new_MEM_POOLS = (MemPool*) realloc( MEM_POOLS, (MEM_POOLS_COUNT+1)*sizeof(MemPool) );
-        if (!new_MEM_POOLS) return NULL;
-        
-        MEM_POOLS = new_MEM_POOLS;
-        MEM_POOLS_COUNT++;
+        MemPool *pool = &alloc->mem_pools[mem_pool_id];
+        if ( pool->*table )
+            continue;
 
-        MEM_POOLS[MEM_POOLS_COUNT-1].mempool = (byte *) calloc( MEM_POOL_SIZE, BLOCK_SIZE );
-        if ( !MEM_POOLS[MEM_POOLS_COUNT-1].mempool ) return NULL;
-    
-        init_mem_pool( MEM_POOLS_COUNT-1 );
+        pool->*table = (T *) calloc( pool->size, sizeof(T) );
+        if ( !(pool->*table) )
+        {
+            res = TREE_ALLOC_ERR_CANT_ALLOC_MEM;
+            break;
+        }
     }
 
-    size_t old_free_ptr = MEM_POOLS[ free_mem_pool_id ].free_elem_ind;
-    size_t new_free_ptr = ACCESS_FREE_MEM_BLOCK( free_mem_pool_id, old_free_ptr );
-    MEM_POOLS[ free_mem_pool_id ].free_elem_ind = new_free_ptr;
+    if ( res == TREE_ALLOC_OK )
+        *enabled = true;
 
-    void *new_mem_block_ptr = &ACCESS_FREE_MEM_BLOCK( free_mem_pool_id, old_free_ptr );
-    memset( new_mem_block_ptr, 0, BLOCK_SIZE );
+    unlock_alloc( alloc );
 
-    ((TreeNode *) new_mem_block_ptr)->mem_pool_id = free_mem_pool_id;
-    ((TreeNode *) new_mem_block_ptr)->mem_pool_anchor = old_free_ptr;
+    return res;
+}
 
-    return new_mem_block_ptr;
+TreeAllocRes _tree_alloc_enable_refs( TreeAlloc *alloc )
+{
+    if ( !alloc ) return TREE_ALLOC_ERR_NOT_INITED;
+
+    return enable_side_table( alloc, &MemPool::refs, &alloc->refs_enabled );
 }
 
-TreeAllocRes _tree_alloc_del( TreeNode *node_ptr )
+uint32_t *_tree_alloc_ref( TreeAlloc *alloc, const TreeNode *node_ptr )
 {
+    assert(alloc);
+    assert(alloc->refs_enabled);
+
+    size_t mem_pool_id      = 0;
+    size_t mem_pool_anchor  = 0;
+    locate_block( alloc, node_ptr, &mem_pool_id, &mem_pool_anchor );
+
+    assert(mem_pool_id < alloc->mem_pools_count);
+
+    return &alloc->mem_pools[mem_pool_id].refs[mem_pool_anchor];
+}
+
+TreeAllocRes _tree_alloc_enable_hashes( TreeAlloc *alloc )
+{
+    if ( !alloc ) return TREE_ALLOC_ERR_NOT_INITED;
+
+    return enable_side_table( alloc, &MemPool::hashes, &alloc->hashes_enabled );
+}
+
+size_t *_tree_alloc_hash( TreeAlloc *alloc, const TreeNode *node_ptr )
+{
+    assert(alloc);
+    assert(alloc->hashes_enabled);
+
+    size_t mem_pool_id      = 0;
+    size_t mem_pool_anchor  = 0;
+    locate_block( alloc, node_ptr, &mem_pool_id, &mem_pool_anchor );
+
+    assert(mem_pool_id < alloc->mem_pools_count);
+
+    return &alloc->mem_pools[mem_pool_id].hashes[mem_pool_anchor];
+}
+
+//! @brief Returns the first live block of the pool with index not less than 'anchor', or NULL.
+inline TreeNode *find_live_in_pool( const TreeAlloc *alloc, size_t mem_pool_id, size_t anchor )
+{
+    const MemPool *pool = &alloc->mem_pools[mem_pool_id];
+    if ( anchor >= pool->used_size )
+        return NULL;
+
+    size_t word_ind = anchor / LIVE_WORD_BITS;
+    uint64_t word   = pool->live_bits[word_ind] & ( ~(uint64_t) 0 << (anchor % LIVE_WORD_BITS) );
+
+    size_t words_count = (pool->used_size + LIVE_WORD_BITS - 1) / LIVE_WORD_BITS;
+    while ( word == 0 )
+    {
+        if ( ++word_ind == words_count )
+            return NULL;
+        word = pool->live_bits[word_ind];
+    }
+
+    size_t found = word_ind * LIVE_WORD_BITS + (size_t) __builtin_ctzll( word );
+    if ( found >= pool->used_size )
+        return NULL;
+
+    return (TreeNode *) (void *) ( pool->mempool + found * alloc->block_size );
+}
+
+//! @brief Returns the first live block, starting with block 'anchor' of the pool
+//! 'mem_pool_id' and going through the next pools, or NULL.
+inline TreeNode *find_live( const TreeAlloc *alloc, size_t mem_pool_id, size_t anchor )
+{
+    for (; mem_pool_id < alloc->mem_pools_count; mem_pool_id++, anchor = 0)
+    {
+        TreeNode *found = find_live_in_pool( alloc, mem_pool_id, anchor );
+        if (found)
+            return found;
+    }
+
+    return NULL;
+}
+
+TreeNode *_tree_alloc_first_live( const TreeAlloc *alloc )
+{
+    if ( !alloc ) return NULL;
+
+    return find_live( alloc, 0, 0 );
+}
+
+TreeNode *_tree_alloc_next_live( const TreeAlloc *alloc, const TreeNode *node_ptr )
+{
+    assert(alloc);
     assert(node_ptr);
 
-    if ( MEM_POOLS_COUNT == 0 ) return TREE_ALLOC_ERR_NOT_INITED;
+    size_t mem_pool_id      = 0;
+    size_t mem_pool_anchor  = 0;
+    locate_block( alloc, node_ptr, &mem_pool_id, &mem_pool_anchor );
+
+    assert(mem_pool_id < alloc->mem_pools_count);
+
+    return find_live( alloc, mem_pool_id, mem_pool_anchor + 1 );
+}
+
+//! @brief Puts all pools, which have free blocks and are not evacuated, into the list
+//! of free pools, so that blocks are given away starting from the first pool.
+inline void rebuild_free_pools( TreeAlloc *alloc )
+{
+    alloc->free_pools_head = NO_FREE_POOL;
+
+    for (size_t mem_pool_id = alloc->mem_pools_count; mem_pool_id > 0; mem_pool_id--)
+    {
+        MemPool *pool = &alloc->mem_pools[mem_pool_id - 1];
+        pool->next_free_pool = NO_FREE_POOL;
+
+        if ( !pool->evacuated && !is_mempool_full( alloc, mem_pool_id - 1 ) )
+            push_free_pool( alloc, mem_pool_id - 1 );
+    }
+}
+
+//! @brief Order of pools, in which they are kept by compaction:
+//! bigger ones first, and of equal ones - those with more live blocks.
+static int cmp_pools_to_keep( const void *a, const void *b, void *mem_pools )
+{
+    const MemPool *pool_a = &((const MemPool *) mem_pools)[ *(const size_t *) a ];
+    const MemPool *pool_b = &((const MemPool *) mem_pools)[ *(const size_t *) b ];
+
+    if ( pool_a->size != pool_b->size )
+        return ( pool_a->size > pool_b->size ? -1 : 1 );
+    if ( pool_a->live_count != pool_b->live_count )
+        return ( pool_a->live_count > pool_b->live_count ? -1 : 1 );
+
+    return 0;
+}
+
+TreeAllocRes _tree_alloc_compact_begin( TreeAlloc *alloc, size_t live_count )
+{
+    if ( !alloc || alloc->mem_pools_count == 0 ) return TREE_ALLOC_ERR_NOT_INITED;
+
+    size_t *order = (size_t *) calloc( alloc->mem_pools_count, sizeof(size_t) );
+    if (!order) return TREE_ALLOC_ERR_CANT_ALLOC_MEM;
+
+    lock_alloc( alloc );
+
+    for (size_t ind = 0; ind < alloc->mem_pools_count; ind++)
+        order[ind] = ind;
+    qsort_r( order, alloc->mem_pools_count, sizeof(size_t), cmp_pools_to_keep, alloc->mem_pools );
 
-    size_t mem_pool_id      = node_ptr->mem_pool_id;
-    size_t mem_pool_anchor  = node_ptr->mem_pool_anchor;
+    // at least one pool is kept, even if there are no live blocks
+    size_t capacity = 0;
+    for (size_t ind = 0; ind < alloc->mem_pools_count; ind++)
+    {
+        MemPool *pool = &alloc->mem_pools[ order[ind] ];
+
+        pool->evacuated = ( ind > 0 && capacity >= live_count );
+        if ( !pool->evacuated )
+            capacity += pool->size;
+    }
+
+    rebuild_free_pools( alloc );
+
+    unlock_alloc( alloc );
 
-    size_t old_free = MEM_POOLS[ mem_pool_id ].free_elem_ind;
-    ACCESS_FREE_MEM_BLOCK( mem_pool_id, mem_pool_anchor ) = old_free;
-    MEM_POOLS[ mem_pool_id ].free_elem_ind = mem_pool_anchor;
+    free( order );
 
     return TREE_ALLOC_OK;
 }
 
-TreeAllocRes _tree_alloc_deinit()
+TreeAllocRes _tree_alloc_relayout_begin( TreeAlloc *alloc, size_t live_count )
 {
-    if ( MEM_POOLS_COUNT == 0 ) return TREE_ALLOC_ERR_ALREADY_INITED;
+    if ( !alloc || alloc->mem_pools_count == 0 ) return TREE_ALLOC_ERR_NOT_INITED;
+
+    size_t new_size = ( live_count ? live_count : 1 );
+
+    lock_alloc( alloc );
+
+#ifdef TREE_COMPACT_NODES
+    // add_mem_pool() cuts the pool, if the region ends, but it must hold all blocks
+    size_t new_id = 0;
+    if ( !find_region_range( alloc, new_size, &new_id ) )
+    {
+        unlock_alloc( alloc );
+        return TREE_ALLOC_ERR_CANT_ALLOC_MEM;
+    }
+#endif
+
+    for (size_t mem_pool_id = 0; mem_pool_id < alloc->mem_pools_count; mem_pool_id++)
+        alloc->mem_pools[mem_pool_id].evacuated = true;
+
+    rebuild_free_pools( alloc );
+
+    TreeAllocRes res = add_mem_pool( alloc, new_size );
+    if ( res != TREE_ALLOC_OK )
+    {
+        for (size_t mem_pool_id = 0; mem_pool_id < alloc->mem_pools_count; mem_pool_id++)
+            alloc->mem_pools[mem_pool_id].evacuated = false;
+
+        rebuild_free_pools( alloc );
+    }
+
+    unlock_alloc( alloc );
+
+    return res;
+}
+
+int _tree_alloc_is_evacuated( const TreeAlloc *alloc, const TreeNode *node_ptr )
+{
+    assert(alloc);
+
+    size_t mem_pool_id      = 0;
+    size_t mem_pool_anchor  = 0;
+    locate_block( alloc, node_ptr, &mem_pool_id, &mem_pool_anchor );
+
+    assert(mem_pool_id < alloc->mem_pools_count);
+
+    return alloc->mem_pools[mem_pool_id].evacuated;
+}
+
+//! @brief Gives memory of the evacuated (empty) pool back to the OS.
+inline void release_mem_pool( TreeAlloc *alloc, MemPool *pool )
+{
+    assert( pool->live_count == 0 );
+
+#ifdef TREE_COMPACT_NODES
+    // only whole pages of the pool are decommitted, its range is cut again by add_mem_pool()
+    uintptr_t page  = (uintptr_t) sysconf( _SC_PAGESIZE );
+    uintptr_t start = ( (uintptr_t) pool->mempool + page - 1 ) / page * page;
+    uintptr_t end   = ( (uintptr_t) pool->mempool + pool->size * alloc->block_size ) / page * page;
+    if ( start < end )
+        madvise( (void *) start, end - start, MADV_DONTNEED );
+#else /* NOT TREE_COMPACT_NODES */
+    (void) alloc;
+    free( pool->mempool );
+#endif /* TREE_COMPACT_NODES */
+
+    free( pool->live_bits );
+    free( pool->refs );
+    free( pool->hashes );
+    *pool = {};
+}
+
+TreeAllocRes _tree_alloc_compact_end( TreeAlloc *alloc )
+{
+    if ( !alloc ) return TREE_ALLOC_ERR_NOT_INITED;
+
+    lock_alloc( alloc );
+
+    // kept pools are shifted to the beginning, so that their order (by addresses) is kept
+    size_t kept_count = 0;
+    for (size_t mem_pool_id = 0; mem_pool_id < alloc->mem_pools_count; mem_pool_id++)
+    {
+        MemPool *pool = &alloc->mem_pools[mem_pool_id];
+        if ( pool->evacuated )
+        {
+            release_mem_pool( alloc, pool );
+            continue;
+        }
+
+        size_t new_id = kept_count++;
+        if ( new_id == mem_pool_id )
+            continue;
 
-    for (size_t mem_pool_id = 0; mem_pool_id < MEM_POOLS_COUNT; mem_pool_id++)
+        alloc->mem_pools[new_id] = *pool;
+        *pool = {};
+
+#ifndef TREE_COMPACT_NODES
+        // ids of pools are stored in blocks
+        for ( TreeNode *curr = find_live_in_pool( alloc, new_id, 0 ); curr;
+              curr = find_live_in_pool( alloc, new_id, curr->mem_pool_anchor + 1 ) )
+            curr->mem_pool_id = new_id;
+#endif
+    }
+    alloc->mem_pools_count = kept_count;
+
+    rebuild_free_pools( alloc );
+
+    unlock_alloc( alloc );
+
+    return TREE_ALLOC_OK;
+}
+
+TreeAllocRes _tree_alloc_cache_init( TreeAllocCache *cache, TreeAlloc *alloc )
+{
+    assert(cache);
+
+    if ( !alloc ) return TREE_ALLOC_ERR_NOT_INITED;
+
+    *cache = {};
+    cache->alloc        = alloc;
+
+    return TREE_ALLOC_OK;
+}
+
+TreeAllocRes _tree_alloc_cache_refill_( TreeAllocCache *cache )
+{
+    assert(cache);
+
+    TreeAlloc *alloc = cache->alloc;
+    if ( !alloc ) return TREE_ALLOC_ERR_NOT_INITED;
+
+    lock_alloc( alloc );
+    while ( cache->count < TREE_ALLOC_CACHE_SIZE / 2 )
+    {
+        void *block = alloc_new( alloc );
+        if (!block)
+            break;
+        cache->blocks[cache->count++] = block;
+    }
+    unlock_alloc( alloc );
+
+    return ( cache->count ? TREE_ALLOC_OK : TREE_ALLOC_ERR_CANT_ALLOC_MEM );
+}
+
+TreeAllocRes _tree_alloc_cache_drain_( TreeAllocCache *cache, size_t leave )
+{
+    assert(cache);
+
+    TreeAlloc *alloc = cache->alloc;
+    if ( !alloc ) return TREE_ALLOC_ERR_NOT_INITED;
+
+    lock_alloc( alloc );
+    while ( cache->count > leave )
+        alloc_del( alloc, (TreeNode *) cache->blocks[--cache->count] );
+    unlock_alloc( alloc );
+
+    return TREE_ALLOC_OK;
+}
+
+TreeAllocRes _tree_alloc_deinit( TreeAlloc **alloc_ptr )
+{
+    assert(alloc_ptr);
+
+    TreeAlloc *alloc = *alloc_ptr;
+    if ( !alloc ) return TREE_ALLOC_ERR_NOT_INITED;
+
+#ifdef TREE_COMPACT_NODES
+    munmap( alloc->region, TREE_COMPACT_REGION_SIZE );
+#else /* NOT TREE_COMPACT_NODES */
+    for (size_t mem_pool_id = 0; mem_pool_id < alloc->mem_pools_count; mem_pool_id++)
+    {
+        free( alloc->mem_pools[ mem_pool_id ].mempool );
+    }
+#endif /* TREE_COMPACT_NODES */
+    for (size_t mem_pool_id = 0; mem_pool_id < alloc->mem_pools_count; mem_pool_id++)
     {
-        free( MEM_POOLS[ mem_pool_id ].mempool );
+        free( alloc->mem_pools[ mem_pool_id ].live_bits );
+        free( alloc->mem_pools[ mem_pool_id ].refs );
+        free( alloc->mem_pools[ mem_pool_id ].hashes );
     }
-    free( MEM_POOLS );
+    pthread_mutex_destroy( &alloc->mutex );
+    free( alloc->mem_pools );
+    free( alloc );
 
-    BLOCK_SIZE = 0;
-    MEM_POOL_SIZE = 0;
-    MEM_POOLS_COUNT = 0;
+    *alloc_ptr = NULL;
 
     return TREE_ALLOC_OK;
 }
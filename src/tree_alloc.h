@@ -8,7 +8,6 @@ enum TreeAllocRes
 {
     TREE_ALLOC_OK,
     TREE_ALLOC_WRONG_MEM_POOL_SIZE_TO_INIT,
-    TREE_ALLOC_ERR_ALREADY_INITED,
     TREE_ALLOC_ERR_CANT_ALLOC_MEM,
     TREE_ALLOC_ERR_NOT_INITED
 };
@@ -16,24 +15,159 @@ enum TreeAllocRes
 
 
 //! @attention ONLY FOR INTERNAL USE!
-//! @brief Initializes first mem_pool and sets common for
-//! all mem pools mem_pool_size, which is number
-//! of 'TreeNodes with data' to be stored in the mem pool,
-//! NOT number of bytes!
-TreeAllocRes _tree_alloc_init( size_t tree_node_with_data_size, size_t mem_pool_size );
+//! @brief Creates new allocator context and initializes its first mem_pool
+//! of mem_pool_size, which is number of 'TreeNodes with data' to be stored
+//! in the mem pool, NOT number of bytes! Every next mem pool is twice
+//! as big as the previous one, until max_mem_pool_size (also in blocks) is reached.
+//! Pointer to the new context is written by 'alloc_ptr'.
+//! @note Every tree owns its own context, so contexts of different
+//! trees never share any memory or state.
+TreeAllocRes _tree_alloc_init(  TreeAlloc **alloc_ptr,
+                                size_t tree_node_with_data_size,
+                                size_t mem_pool_size,
+                                size_t max_mem_pool_size = TREE_DEFAULT_MAX_MEM_POOL_SIZE );
+
+//! @attention ONLY FOR INTERNAL USE!
+//! @brief Sets the cap (in blocks) for sizes of mem pools, which are to be created.
+TreeAllocRes _tree_alloc_set_max_mem_pool_size( TreeAlloc *alloc, size_t max_mem_pool_size );
 
 //! @attention ONLY FOR INTERNAL USE!
 //! @brief Should replace calloc( 1, sizeof(TreeNode) + tree_ptr->data_size )
 //! @return Pointer to allocated memory, or NULL if some error happened.
-void* _tree_alloc_new();
+void* _tree_alloc_new( TreeAlloc *alloc );
 
 //! @attention ONLY FOR INTERNAL USE!
 //! @brief Frees memory, where given node_ptr is located.
-TreeAllocRes _tree_alloc_del( TreeNode *node_ptr );
+//! @note 'node_ptr' must be allocated from the same 'alloc'.
+TreeAllocRes _tree_alloc_del( TreeAlloc *alloc, TreeNode *node_ptr );
+
+//! @attention ONLY FOR INTERNAL USE!
+//! @brief Marks all blocks of all mem pools as free, without freeing
+//! mem pools themselves. Takes time proportional to the number of mem pools.
+//! @note All pointers to the nodes, allocated from 'alloc', become invalid.
+TreeAllocRes _tree_alloc_reset( TreeAlloc *alloc );
+
+//! @attention ONLY FOR INTERNAL USE!
+//! @brief Writes statistics of the context into 'stats' (see TreeAllocStats).
+//! Takes time proportional to the number of mem pools.
+TreeAllocRes _tree_alloc_get_stats( TreeAlloc *alloc, TreeAllocStats *stats );
+
+//! @attention ONLY FOR INTERNAL USE!
+//! @brief In concurrent mode every operation with memory pools takes the lock of the
+//! context, so the context can be used from several threads at once (usually through
+//! TreeAllocCache, so that the lock is taken once per batch of blocks).
+//! @note Only parallel copy uses this mode: fields of the tree (nodes_count, level_hist)
+//! aren't thread-safe, so nodes of one tree can't be created from several threads otherwise.
+//! Every tree owns its own context, so trees, used by different threads, don't need this mode.
+TreeAllocRes _tree_alloc_set_concurrent( TreeAlloc *alloc, bool concurrent );
+
+//! @attention ONLY FOR INTERNAL USE!
+//! @brief Creates a table of reference counters (one uint32_t per block) for every
+//! memory pool, present and future. Every block, given away after this, has counter 1.
+//! Counters aren't used by the allocator itself, blocks are freed only by _tree_alloc_del().
+TreeAllocRes _tree_alloc_enable_refs( TreeAlloc *alloc );
+
+//! @attention ONLY FOR INTERNAL USE!
+//! @brief Returns pointer to the reference counter of the block, where 'node_ptr' is located.
+//! @note Reference counters must be enabled.
+uint32_t *_tree_alloc_ref( TreeAlloc *alloc, const TreeNode *node_ptr );
+
+//! @attention ONLY FOR INTERNAL USE!
+//! @brief Creates a table of cached hashes (one size_t per block) for every memory pool,
+//! present and future. Every block, given away after this, has hash 0.
+TreeAllocRes _tree_alloc_enable_hashes( TreeAlloc *alloc );
+
+//! @attention ONLY FOR INTERNAL USE!
+//! @brief Returns pointer to the cached hash of the block, where 'node_ptr' is located.
+//! @note Cached hashes must be enabled.
+size_t *_tree_alloc_hash( TreeAlloc *alloc, const TreeNode *node_ptr );
+
+//! @attention ONLY FOR INTERNAL USE!
+//! @brief Returns the first block, which is given away (live node), in the order of
+//! memory pools and of blocks in them, or NULL if there are no live blocks.
+//! Together with _tree_alloc_next_live() walks all live nodes, reading one bit
+//! per block (from the occupancy bitmaps of pools) instead of the blocks themselves.
+//! @note Blocks, held by TreeAllocCache, are live too.
+TreeNode *_tree_alloc_first_live( const TreeAlloc *alloc );
+
+//! @attention ONLY FOR INTERNAL USE!
+//! @brief Returns the next live block after 'node_ptr' (see _tree_alloc_first_live()),
+//! or NULL. 'node_ptr' must be a live block of 'alloc'.
+TreeNode *_tree_alloc_next_live( const TreeAlloc *alloc, const TreeNode *node_ptr );
+
+//! @attention ONLY FOR INTERNAL USE!
+//! @brief Starts compaction: chooses pools to be kept (the biggest ones, until they can
+//! hold 'live_count' blocks) and stops giving away blocks of the other (evacuated) pools.
+//! Then the caller must move every live block of evacuated pools (take a new block by
+//! _tree_alloc_new(), which gives away only blocks of kept pools, and give back the old one
+//! by _tree_alloc_del()) and call _tree_alloc_compact_end().
+//! @note 'live_count' must be not less than the number of live blocks.
+TreeAllocRes _tree_alloc_compact_begin( TreeAlloc *alloc, size_t live_count );
+
+//! @attention ONLY FOR INTERNAL USE!
+//! @brief Starts relayout: all pools become evacuated, and a new pool of 'live_count' blocks
+//! is added. Its blocks are given away one after another, so blocks are placed in memory
+//! in the order, in which they are taken. Then everything is done as for compaction:
+//! the caller moves every live block and calls _tree_alloc_compact_end().
+//! @note Until then memory for blocks is taken twice.
+TreeAllocRes _tree_alloc_relayout_begin( TreeAlloc *alloc, size_t live_count );
+
+//! @attention ONLY FOR INTERNAL USE!
+//! @brief Returns 1 if the block is in a pool, which is being evacuated, 0 otherwise.
+int _tree_alloc_is_evacuated( const TreeAlloc *alloc, const TreeNode *node_ptr );
+
+//! @attention ONLY FOR INTERNAL USE!
+//! @brief Finishes compaction: gives memory of evacuated pools (which must be empty)
+//! back to the OS and removes them, so ids of other pools may change.
+TreeAllocRes _tree_alloc_compact_end( TreeAlloc *alloc );
+
+const size_t TREE_ALLOC_CACHE_SIZE = 64;
+
+//! @attention ONLY FOR INTERNAL USE!
+//! @brief Per-thread cache (magazine) of free blocks of one context, used by parallel
+//! copy. Blocks are taken from memory pools by batches of TREE_ALLOC_CACHE_SIZE / 2
+//! blocks, and blocks, which are left unused, are given back by _tree_alloc_cache_flush().
+//! @note All blocks in the cache are just allocated (cleared, with counter 1 and hash 0).
+struct TreeAllocCache
+{
+    TreeAlloc *alloc    = NULL;
+    size_t count        = 0;
+    void *blocks[TREE_ALLOC_CACHE_SIZE] = {};
+};
+
+//! @attention ONLY FOR INTERNAL USE!
+TreeAllocRes _tree_alloc_cache_init( TreeAllocCache *cache, TreeAlloc *alloc );
+
+//! @attention ONLY FOR INTERNAL USE!
+//! @brief Takes blocks from memory pools, until the cache is half full.
+TreeAllocRes _tree_alloc_cache_refill_( TreeAllocCache *cache );
+
+//! @attention ONLY FOR INTERNAL USE!
+//! @brief Gives blocks back to memory pools, until only 'leave' blocks are in the cache.
+TreeAllocRes _tree_alloc_cache_drain_( TreeAllocCache *cache, size_t leave );
+
+//! @attention ONLY FOR INTERNAL USE!
+//! @brief Does the same as _tree_alloc_new(), but takes the block from the cache.
+//! Locks memory pools only if the cache is empty.
+inline void *_tree_alloc_cache_new( TreeAllocCache *cache )
+{
+    if ( cache->count == 0 && _tree_alloc_cache_refill_( cache ) != TREE_ALLOC_OK )
+        return NULL;
+
+    return cache->blocks[--cache->count];
+}
+
+//! @attention ONLY FOR INTERNAL USE!
+//! @brief Gives all blocks of the cache back to memory pools. Must be called
+//! before the cache is thrown away.
+inline TreeAllocRes _tree_alloc_cache_flush( TreeAllocCache *cache )
+{
+    return _tree_alloc_cache_drain_( cache, 0 );
+}
 
 //! @attention ONLY FOR INTERNAL USE!
-//! @brief Frees all allocated memory, after this func
-//! _tree_alloc_init can be called again.
-TreeAllocRes _tree_alloc_deinit();
+//! @brief Frees all memory of the context, including the context itself,
+//! and sets *alloc_ptr to NULL. After this func _tree_alloc_init can be called again.
+TreeAllocRes _tree_alloc_deinit( TreeAlloc **alloc_ptr );
 
 #endif /* TREE_ALLOC_H */
@@ -3,11 +3,22 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <stddef.h>
+#include <assert.h>
 
 /*
     AVAILABLE DEFINES:
     - TREE_DO_DUMP
     - TREE_ABORT_ON_DUMP - requires TREE_DO_DUMP
+    - TREE_COMPACT_NODES - nodes are linked with 32-bit relative links and
+      don't store data pointer and allocator info (see TreeNode)
+    - TREE_SELFCHECK_PERIOD=N - requires TREE_DO_DUMP, every N-th call of a tree
+      function verifies the whole tree, other calls do only O(1) checks
+      (see TreeVerifyLevel); 1 means full verification on every call
+    - TREE_SELFCHECK_DEEP - requires TREE_DO_DUMP, periodic verification
+      is deep (TREE_VERIFY_DEEP) instead of full
+    - TREE_DO_TRACE - calls of operations of tree.h are counted and timed,
+      and the hook is called after them (see tree_trace.h)
 */
 
 #ifndef NDEBUG
@@ -16,6 +27,20 @@
 
 #ifdef TREE_DO_DUMP
 typedef uint64_t tree_verify_t;
+
+#ifndef TREE_SELFCHECK_PERIOD
+#define TREE_SELFCHECK_PERIOD 1024
+#endif
+
+static_assert( TREE_SELFCHECK_PERIOD > 0, "TREE_SELFCHECK_PERIOD must be positive" );
+
+//! @brief How much is checked by tree_verify_level(), every level includes previous ones.
+enum TreeVerifyLevel
+{
+    TREE_VERIFY_CHEAP,  //< O(1) checks of fields of the tree and of its root.
+    TREE_VERIFY_FULL,   //< + one walk over all nodes (count and data pointers).
+    TREE_VERIFY_DEEP,   //< + links, levels of all nodes and level_hist, in the same walk.
+};
 #endif /* TREE_DO_DUMP */
 
 
@@ -27,7 +52,7 @@ enum TreeStatus
 #undef DEF_TREE_STATUS
 
 #ifdef TREE_DO_DUMP
-#define DEF_TREE_VERIFY_FLAG(name, message, cond) TREE_VERIFY_##name,
+#define DEF_TREE_VERIFY_FLAG(name, message, level, cond) TREE_VERIFY_##name,
 enum TreeVerifyFlag
 {
     #include "tree_verify_flags.h"
@@ -35,6 +60,41 @@ enum TreeVerifyFlag
 #undef DEF_TREE_VERIFY_FLAG
 #endif /* TREE_DO_DUMP */
 
+#ifdef TREE_COMPACT_NODES
+//! @brief Link to another node, stored as a distance from the node, containing
+//! the link, to the linked one, measured in TREE_LINK_UNIT bytes. 0 means NULL.
+//! @note All nodes of a tree are allocated from one reserved address range
+//! (see TREE_COMPACT_REGION_SIZE), so any two of them can be linked.
+typedef int32_t tree_link_t;
+
+const size_t TREE_LINK_UNIT = 8;
+
+//! @brief Size of the address range, reserved (not committed!) for nodes
+//! of one tree. Can't be bigger than 16 GiB, so that links fit into tree_link_t.
+#ifndef TREE_COMPACT_REGION_SIZE
+#define TREE_COMPACT_REGION_SIZE ( (size_t) 4 << 30 )
+#endif
+
+static_assert( TREE_COMPACT_REGION_SIZE <= ((size_t) INT32_MAX + 1) * TREE_LINK_UNIT,
+               "TREE_COMPACT_REGION_SIZE is too big for 32-bit links" );
+
+//! @note Data is located at the memory block right after where TreeNode is
+//! located itself. Number of bytes to read as data is stored in the Tree struct.
+//! Id of the memory pool and anchor are calculated by the allocator from the
+//! address of the node.
+//! @note Node takes 16 bytes instead of 56, but data is still padded up to
+//! TREE_DATA_ALIGN, so a whole block with 4-16 bytes of data is only
+//! 2.25-2.7 times smaller (e.g. 24 bytes instead of 64 for 8 bytes of data).
+//! @attention Fields mustn't be accessed directly, use tree_node_*() functions.
+struct TreeNode
+{
+    tree_link_t left    = 0;
+    tree_link_t right   = 0;
+    tree_link_t parent  = 0;
+
+    uint32_t level = 0;     //< Distance from the root node.
+};
+#else /* NOT TREE_COMPACT_NODES */
 //! @note data_ptr points at the memory block right after
 //! where TreeNode is located itself. Number of bytes to read as data
 //! is stored in the Tree struct.
@@ -47,15 +107,152 @@ struct TreeNode
 
     size_t level = 0;        //< Distance from the root node.
 
-#ifdef TREE_DO_DUMP
-    TreeNode *prev = NULL;  //< Is used in tree_dump()
-    TreeNode *next = NULL;  //< Is used in tree_dump()
-#endif /* TREE_DO_DUMP */
-
     // Used for tree_alloc
     size_t mem_pool_id      = 0;
     size_t mem_pool_anchor  = 0;
 };
+#endif /* TREE_COMPACT_NODES */
+
+
+// Accessors of TreeNode fields, which work with both layouts of TreeNode.
+
+#ifdef TREE_COMPACT_NODES
+inline TreeNode *tree_link_decode_( const TreeNode *node_ptr, tree_link_t link )
+{
+    if ( link == 0 )
+        return NULL;
+
+    return (TreeNode *) ( (uintptr_t) node_ptr + (uintptr_t) ((intptr_t) link * (intptr_t) TREE_LINK_UNIT) );
+}
+
+inline tree_link_t tree_link_encode_( const TreeNode *node_ptr, const TreeNode *target_ptr )
+{
+    if ( target_ptr == NULL )
+        return 0;
+
+    intptr_t dist = ( (intptr_t) target_ptr - (intptr_t) node_ptr ) / (intptr_t) TREE_LINK_UNIT;
+    assert( dist != 0 && dist >= INT32_MIN && dist <= INT32_MAX );
+
+    return (tree_link_t) dist;
+}
+
+#define TREE_NODE_GET_LINK_( node_ptr__, field__ ) \
+    tree_link_decode_( node_ptr__, (node_ptr__)->field__ )
+#define TREE_NODE_SET_LINK_( node_ptr__, field__, target_ptr__ ) \
+    (node_ptr__)->field__ = tree_link_encode_( node_ptr__, target_ptr__ )
+#else /* NOT TREE_COMPACT_NODES */
+#define TREE_NODE_GET_LINK_( node_ptr__, field__ ) \
+    ( (node_ptr__)->field__ )
+#define TREE_NODE_SET_LINK_( node_ptr__, field__, target_ptr__ ) \
+    (node_ptr__)->field__ = (target_ptr__)
+#endif /* TREE_COMPACT_NODES */
+
+inline TreeNode *tree_node_left( const TreeNode *node_ptr )
+{
+    return TREE_NODE_GET_LINK_( node_ptr, left );
+}
+
+inline TreeNode *tree_node_right( const TreeNode *node_ptr )
+{
+    return TREE_NODE_GET_LINK_( node_ptr, right );
+}
+
+inline TreeNode *tree_node_parent( const TreeNode *node_ptr )
+{
+    return TREE_NODE_GET_LINK_( node_ptr, parent );
+}
+
+inline void tree_node_set_left( TreeNode *node_ptr, TreeNode *left )
+{
+    TREE_NODE_SET_LINK_( node_ptr, left, left );
+}
+
+inline void tree_node_set_right( TreeNode *node_ptr, TreeNode *right )
+{
+    TREE_NODE_SET_LINK_( node_ptr, right, right );
+}
+
+inline void tree_node_set_parent( TreeNode *node_ptr, TreeNode *parent )
+{
+    TREE_NODE_SET_LINK_( node_ptr, parent, parent );
+}
+
+inline size_t tree_node_level( const TreeNode *node_ptr )
+{
+    return node_ptr->level;
+}
+
+inline void tree_node_set_level( TreeNode *node_ptr, size_t level )
+{
+#ifdef TREE_COMPACT_NODES
+    assert( level <= UINT32_MAX );
+    node_ptr->level = (uint32_t) level;
+#else
+    node_ptr->level = level;
+#endif
+}
+
+inline void *tree_node_data( const TreeNode *node_ptr )
+{
+#ifdef TREE_COMPACT_NODES
+    return (void *) ( (uintptr_t) node_ptr + sizeof(TreeNode) );
+#else
+    return node_ptr->data_ptr;
+#endif
+}
+
+#undef TREE_NODE_GET_LINK_
+#undef TREE_NODE_SET_LINK_
+
+//! @brief Allocator context, see tree_alloc.h.
+//! Every tree owns its own one.
+struct TreeAlloc;
+
+//! @brief Number of buckets in TreeAllocStats::pools_by_occupancy.
+const size_t TREE_ALLOC_OCCUPANCY_BUCKETS = 4;
+
+//! @brief Statistics of the allocator of a tree, see tree_get_stats().
+//! @note Counters are kept in all builds (they are updated together with
+//! the pool, which is touched anyway), other fields are collected by the query.
+struct TreeAllocStats
+{
+    size_t block_size           = 0;    //< In bytes: TreeNode, data and alignment.
+    size_t mem_pools_count      = 0;
+
+    size_t allocs_count         = 0;    //< Blocks, given away since the tree was constructed.
+    size_t frees_count          = 0;    //< Blocks, given back (tree_clear() gives back all).
+    size_t failed_allocs_count  = 0;    //< Allocations, failed because no new pool was got.
+
+    size_t live_blocks          = 0;    //< allocs_count - frees_count.
+    size_t peak_live_blocks     = 0;    //< Max of live_blocks since the tree was constructed.
+
+    size_t reserved_blocks      = 0;    //< Sum of sizes of all pools.
+    //! @brief Blocks, given away at least once since their pools were (re)initialized.
+    //! The rest of reserved blocks has never been touched.
+    size_t touched_blocks       = 0;
+    //! @brief Touched, but not live blocks (holes in pools), they are given away
+    //! before untouched ones. free_list_blocks / touched_blocks is fragmentation.
+    size_t free_list_blocks     = 0;
+
+    size_t reserved_bytes       = 0;    //< Pools, their side tables and bitmaps.
+    size_t used_bytes           = 0;    //< live_blocks * block_size.
+
+    size_t empty_pools_count    = 0;    //< Pools without live blocks.
+    //! @brief Bucket i is number of non-empty pools, which have more than i / N
+    //! and not more than (i + 1) / N of their blocks live (N is TREE_ALLOC_OCCUPANCY_BUCKETS).
+    size_t pools_by_occupancy[TREE_ALLOC_OCCUPANCY_BUCKETS] = {};
+};
+
+//! @brief Statistics of a tree, see tree_get_stats().
+struct TreeStats
+{
+    size_t nodes_count      = 0;    //< Including loose nodes.
+    size_t depth            = 0;
+    size_t data_size        = 0;
+    size_t snapshots_count  = 0;
+
+    TreeAllocStats alloc    = {};   //< All zeros, if the tree has no allocator (TreeImage).
+};
 
 #ifdef TREE_DO_DUMP
 struct TreeOrigInfo
@@ -75,15 +272,31 @@ struct Tree
     size_t nodes_count  = 0;
     size_t depth        = 0; //< max level of all nodes; if only root exists, equals 0
 
+    //! @brief level_hist[i] is number of nodes with level i. Is used
+    //! to keep 'depth' exact after deletions and migrations.
+    size_t *level_hist      = NULL;
+    size_t level_hist_cap   = 0;    //< Number of elements level_hist has space for.
+
     void (*data_dtor_func_ptr)(void *data_ptr) = NULL;
 
 #ifdef TREE_DO_DUMP
-    TreeNode *head_of_all_nodes = NULL; //< Is used in tree_dump()
     void (*print_data_func_ptr)(FILE* stream, void *data_ptr) = NULL;
     TreeOrigInfo orig_info = {};
+    mutable size_t selfcheck_calls = 0; //< Counts TREE_SELFCHECK()s, see TREE_SELFCHECK_PERIOD.
 #endif /* TREE_DO_DUMP */
 
     size_t typical_num_of_nodes = 0;
+
+    //! @brief Max number of threads for parallel operations, see tree_set_threads_count().
+    size_t threads_count = 1;
+
+    //! @brief If true, nodes can be shared with snapshots, see tree_persist.h.
+    bool persistent = false;
+    size_t snapshots_count = 0; //< Number of snapshots, which are not released yet.
+
+    bool hash_cache = false;    //< If true, hashes of subtrees are cached, see tree_hash.h.
+
+    TreeAlloc *alloc = NULL; //< Pools, from which nodes of this tree are allocated.
 };
 
 
@@ -96,7 +309,7 @@ const char * const tree_status_messages[] =
 #undef DEF_TREE_STATUS
 
 #ifdef TREE_DO_DUMP
-#define DEF_TREE_VERIFY_FLAG(name, message, cond) message,
+#define DEF_TREE_VERIFY_FLAG(name, message, level, cond) message,
 const char * const tree_verification_messages[] =
 {
     #include "tree_verify_flags.h"
@@ -107,9 +320,22 @@ const char * const tree_verification_messages[] =
 const char* const TREE_DUMP_PATH = ".//dumps//";
 const size_t TREE_MAX_DUMP_PATH_LENGHT = 1024;
 const size_t TREE_MAX_CMD_GEN_DUMP_IMG_LENGHT = 1024;
+//! @brief Size of the buffer of dot files of dumps, in bytes.
+const size_t TREE_DUMP_BUFFER_SIZE = 1 << 20;
 #endif /* TREE_DO_DUMP */
 
 
+//! @brief Memory pools of a tree grow geometrically, but none of them
+//! can be bigger than this number of nodes (unless changed by
+//! tree_set_max_mem_pool_size()).
+const size_t TREE_DEFAULT_MAX_MEM_POOL_SIZE = 1 << 18;
+
+
+//! @brief Data of every node is aligned at least by this number of bytes
+//! (nodes are allocated in blocks, which sizes are multiples of it).
+const size_t TREE_DATA_ALIGN = 8;
+
+
 //! @brief call tree_func, returning TreeStatus, and if
 // returned code isn't OK, immediately returns it.
 #define WRP_RET(tree_func) {        \
@@ -0,0 +1,384 @@
+#include "tree_dag.h"
+#include "tree_visit.h"
+#include "tree_alloc.h"
+
+#include <assert.h>
+#include <memory.h>
+#include <stdlib.h>
+
+
+const size_t TREE_DAG_MIN_SLOTS_CAP = 64;
+
+inline size_t mix_hash( size_t hash )
+{
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+
+    return hash;
+}
+
+//! @brief FNV-1a of data bytes, mixed with the child links.
+inline size_t hash_node( size_t data_size, const void *data, const TreeNode *left, const TreeNode *right )
+{
+    size_t hash = 14695981039346656037ULL;
+
+    const unsigned char *bytes = (const unsigned char *) data;
+    for (size_t ind = 0; ind < data_size; ind++)
+    {
+        hash ^= bytes[ind];
+        hash *= 1099511628211ULL;
+    }
+
+    hash = mix_hash( hash ^ (uintptr_t) left );
+    hash = mix_hash( hash ^ (uintptr_t) right );
+
+    return hash;
+}
+
+inline int node_matches( const TreeDag *dag_ptr, const TreeNode *node,
+                         const void *data, const TreeNode *left, const TreeNode *right )
+{
+    return tree_node_left(node) == left
+        && tree_node_right(node) == right
+        && memcmp( tree_node_data(node), data, dag_ptr->tree.data_size ) == 0;
+}
+
+//! @brief Returns the slot with the given node, or the empty slot, where it must be put.
+inline TreeDagSlot *find_slot( const TreeDag *dag_ptr, size_t hash,
+                               const void *data, const TreeNode *left, const TreeNode *right )
+{
+    size_t mask = dag_ptr->slots_cap - 1;
+    for (size_t ind = hash & mask; ; ind = (ind + 1) & mask)
+    {
+        TreeDagSlot *slot = &dag_ptr->slots[ind];
+        if ( !slot->node
+          || ( slot->hash == hash && node_matches( dag_ptr, slot->node, data, left, right ) ) )
+            return slot;
+    }
+}
+
+//! @brief Makes sure that one more node can be put into the hash table,
+//! keeping it at most half full.
+inline TreeStatus reserve_slot( TreeDag *dag_ptr )
+{
+    if ( 2 * (dag_ptr->nodes_count + 1) <= dag_ptr->slots_cap )
+        return TREE_STATUS_OK;
+
+    size_t new_cap = ( dag_ptr->slots_cap ? 2 * dag_ptr->slots_cap : TREE_DAG_MIN_SLOTS_CAP );
+    TreeDagSlot *new_slots = (TreeDagSlot *) calloc( new_cap, sizeof(TreeDagSlot) );
+    if (!new_slots)
+        return TREE_STATUS_ERROR_MEM_ALLOC;
+
+    for (size_t ind = 0; ind < dag_ptr->slots_cap; ind++)
+    {
+        TreeDagSlot slot = dag_ptr->slots[ind];
+        if ( !slot.node )
+            continue;
+
+        size_t new_ind = slot.hash & (new_cap - 1);
+        while ( new_slots[new_ind].node )
+            new_ind = (new_ind + 1) & (new_cap - 1);
+        new_slots[new_ind] = slot;
+    }
+
+    free( dag_ptr->slots );
+    dag_ptr->slots      = new_slots;
+    dag_ptr->slots_cap  = new_cap;
+
+    return TREE_STATUS_OK;
+}
+
+//! @brief Removes the node from the hash table (backward shift deletion,
+//! so that probing sequences of other nodes stay unbroken).
+inline void remove_slot( TreeDag *dag_ptr, const TreeNode *node )
+{
+    size_t mask = dag_ptr->slots_cap - 1;
+
+    size_t hole = hash_node( dag_ptr->tree.data_size, tree_node_data(node),
+                             tree_node_left(node), tree_node_right(node) ) & mask;
+    while ( dag_ptr->slots[hole].node != node )
+        hole = (hole + 1) & mask;
+
+    for (size_t ind = (hole + 1) & mask; dag_ptr->slots[ind].node; ind = (ind + 1) & mask)
+    {
+        // slot can be moved into the hole, if the hole is between its home and it
+        size_t home = dag_ptr->slots[ind].hash & mask;
+        if ( ((ind - home) & mask) >= ((ind - hole) & mask) )
+        {
+            dag_ptr->slots[hole] = dag_ptr->slots[ind];
+            hole = ind;
+        }
+    }
+
+    dag_ptr->slots[hole] = {};
+}
+
+TreeStatus tree_dag_ctor( TreeDag *dag_ptr, size_t data_size_in_bytes, size_t typical_num_of_nodes )
+{
+    assert(dag_ptr);
+
+    *dag_ptr = {};
+
+#ifdef TREE_DO_DUMP
+    WRP_RET( tree_ctor( &dag_ptr->tree, data_size_in_bytes, typical_num_of_nodes, NULL, NULL ) );
+#else
+    WRP_RET( tree_ctor( &dag_ptr->tree, data_size_in_bytes, typical_num_of_nodes, NULL ) );
+#endif
+
+    if ( _tree_alloc_enable_refs( dag_ptr->tree.alloc ) != TREE_ALLOC_OK )
+    {
+        tree_dtor( &dag_ptr->tree );
+        return TREE_STATUS_ERROR_MEM_ALLOC;
+    }
+
+    return TREE_STATUS_OK;
+}
+
+TreeStatus tree_dag_dtor( TreeDag *dag_ptr )
+{
+    assert(dag_ptr);
+
+    tree_dtor( &dag_ptr->tree );
+    free( dag_ptr->slots );
+
+    *dag_ptr = {};
+
+    return TREE_STATUS_OK;
+}
+
+TreeStatus tree_dag_node( TreeDag *dag_ptr, const void *data, TreeNode *left, TreeNode *right, TreeNode **node_ptr )
+{
+    assert(dag_ptr);
+    assert(data);
+    assert(node_ptr);
+
+    TreeAlloc *alloc = dag_ptr->tree.alloc;
+    size_t hash = hash_node( dag_ptr->tree.data_size, data, left, right );
+
+    TreeDagSlot *slot = ( dag_ptr->slots_cap ? find_slot( dag_ptr, hash, data, left, right ) : NULL );
+    if ( slot && slot->node )
+    {
+        uint32_t *refs = _tree_alloc_ref( alloc, slot->node );
+        assert(*refs < UINT32_MAX);
+        (*refs)++;
+
+        *node_ptr = slot->node;
+        return TREE_STATUS_OK;
+    }
+
+    WRP_RET( reserve_slot( dag_ptr ) );
+
+    // counter of the new block is already 1, it is the reference of the user
+    char *new_mem = (char *) _tree_alloc_new( alloc );
+    if (!new_mem)
+        return TREE_STATUS_ERROR_MEM_ALLOC;
+
+    TreeNode *node = (TreeNode *) new_mem;
+#ifndef TREE_COMPACT_NODES
+    node->data_ptr = (void*) (new_mem + sizeof(TreeNode));
+#endif
+    memcpy( tree_node_data(node), data, dag_ptr->tree.data_size );
+    tree_node_set_left( node, left );
+    tree_node_set_right( node, right );
+
+    if (left)
+        (*_tree_alloc_ref( alloc, left ))++;
+    if (right)
+        (*_tree_alloc_ref( alloc, right ))++;
+
+    slot = find_slot( dag_ptr, hash, data, left, right );
+    slot->node  = node;
+    slot->hash  = hash;
+    dag_ptr->nodes_count++;
+
+    *node_ptr = node;
+
+    return TREE_STATUS_OK;
+}
+
+TreeStatus tree_dag_release( TreeDag *dag_ptr, TreeNode *node_ptr )
+{
+    assert(dag_ptr);
+    assert(node_ptr);
+
+    TreeAlloc *alloc = dag_ptr->tree.alloc;
+
+    // nodes to be freed are kept in a stack, linked by their (unused) parent links
+    TreeNode *dead_head = NULL;
+
+    uint32_t *refs = _tree_alloc_ref( alloc, node_ptr );
+    assert(*refs > 0);
+    if ( --(*refs) == 0 )
+    {
+        tree_node_set_parent( node_ptr, NULL );
+        dead_head = node_ptr;
+    }
+
+    while (dead_head)
+    {
+        TreeNode *dead = dead_head;
+        dead_head = tree_node_parent(dead);
+
+        // must be done while the links of the node are still there, they are the key
+        remove_slot( dag_ptr, dead );
+        dag_ptr->nodes_count--;
+
+        TreeNode *children[2] = { tree_node_left(dead), tree_node_right(dead) };
+        for (size_t ind = 0; ind < 2; ind++)
+        {
+            TreeNode *child = children[ind];
+            if (!child)
+                continue;
+
+            uint32_t *child_refs = _tree_alloc_ref( alloc, child );
+            assert(*child_refs > 0);
+            if ( --(*child_refs) == 0 )
+            {
+                tree_node_set_parent( child, dead_head );
+                dead_head = child;
+            }
+        }
+
+        _tree_alloc_del( alloc, dead );
+    }
+
+    return TREE_STATUS_OK;
+}
+
+TreeStatus tree_dag_intern( TreeDag *dag_ptr, const Tree *src, TreeNode *subtree, TreeNode **node_ptr )
+{
+    assert(dag_ptr);
+    assert(src);
+    assert(subtree);
+    assert(node_ptr);
+
+    if ( src->data_size != dag_ptr->tree.data_size )
+        return TREE_STATUS_ERROR_DATA_SIZE_MISMATCH;
+
+    // nodes are put bottom-up; after the first error the rest of nodes only give back
+    // references of their children, so that nothing is left behind
+    TreeStatus status = TREE_STATUS_OK;
+    TreeNode *result = NULL;
+    WRP_RET( tree_fold( src, TreeFoldNone(),
+        []( TreeNode *, const TreeFoldNone & ) { return TreeFoldNone(); },
+        [&]( TreeNode *node, const TreeFoldNone &, TreeNode * const *left, TreeNode * const *right )
+        {
+            TreeNode *left_node  = ( left  ? *left  : NULL );
+            TreeNode *right_node = ( right ? *right : NULL );
+
+            TreeNode *dag_node = NULL;
+            if ( status == TREE_STATUS_OK
+              && ( left_node  || !tree_node_left(node) )
+              && ( right_node || !tree_node_right(node) ) )
+                status = tree_dag_node( dag_ptr, tree_node_data(node), left_node, right_node, &dag_node );
+
+            if (left_node)
+                tree_dag_release( dag_ptr, left_node );
+            if (right_node)
+                tree_dag_release( dag_ptr, right_node );
+
+            return dag_node;
+        },
+        &result, subtree ) );
+
+    if ( status != TREE_STATUS_OK )
+        return status;
+
+    *node_ptr = result;
+
+    return TREE_STATUS_OK;
+}
+
+//! @brief Node of the DAG, which is waiting to be copied under 'parent'.
+struct DagExpandItem
+{
+    const TreeNode *node    = NULL;
+    TreeNode *parent        = NULL;
+    bool as_left            = false;
+};
+
+TreeStatus tree_dag_expand( const TreeDag *dag_ptr, const TreeNode *node_ptr, Tree *dest )
+{
+    assert(dag_ptr);
+    assert(node_ptr);
+    TREE_SELFCHECK(dest);
+
+    if ( dest->data_size != dag_ptr->tree.data_size )
+        return TREE_STATUS_ERROR_DATA_SIZE_MISMATCH;
+    if ( dest->root )
+        return TREE_STATUS_WARNING_ROOT_ALREADY_EXISTS;
+
+    DagExpandItem *stack = NULL;
+    size_t stack_cap    = 0;
+    size_t stack_size   = 0;
+
+    TreeStatus status = TREE_STATUS_OK;
+
+    DagExpandItem item = {};
+    item.node = node_ptr;
+    while ( true )
+    {
+        TreeNode *copy = op_new_TreeNode( dest, tree_node_data(item.node), item.parent );
+        if (!copy)
+        {
+            status = TREE_STATUS_ERROR_MEM_ALLOC;
+            break;
+        }
+
+        if ( !item.parent )
+            dest->root = copy;
+        else if ( item.as_left )
+            tree_node_set_left( item.parent, copy );
+        else
+            tree_node_set_right( item.parent, copy );
+
+        // preorder: the right child waits in the stack, the left one goes next
+        const TreeNode *left  = tree_node_left(item.node);
+        const TreeNode *right = tree_node_right(item.node);
+        if (right)
+        {
+            if ( stack_size == stack_cap )
+            {
+                size_t new_cap = ( stack_cap ? 2 * stack_cap : 16 );
+                DagExpandItem *new_stack = (DagExpandItem *) realloc( stack, new_cap * sizeof(DagExpandItem) );
+                if (!new_stack)
+                {
+                    status = TREE_STATUS_ERROR_MEM_ALLOC;
+                    break;
+                }
+                stack       = new_stack;
+                stack_cap   = new_cap;
+            }
+
+            stack[stack_size].node      = right;
+            stack[stack_size].parent    = copy;
+            stack[stack_size].as_left   = false;
+            stack_size++;
+        }
+
+        if (left)
+        {
+            item.node       = left;
+            item.parent     = copy;
+            item.as_left    = true;
+        }
+        else if (stack_size)
+            item = stack[--stack_size];
+        else
+            break;
+    }
+
+    free( stack );
+
+    if ( status != TREE_STATUS_OK && dest->root )
+    {
+        // data of the copy is a shallow copy of the DAG's one, so it mustn't be destructed
+        void (*data_dtor_func_ptr)(void *data_ptr) = dest->data_dtor_func_ptr;
+        dest->data_dtor_func_ptr = NULL;
+        tree_delete_subtree( dest, dest->root );
+        dest->data_dtor_func_ptr = data_dtor_func_ptr;
+    }
+
+    return status;
+}
@@ -0,0 +1,63 @@
+#ifndef TREE_DAG_H
+#define TREE_DAG_H
+
+#include "tree_common.h"
+
+/*
+    Hash-consed storage of subtrees (DAG). Every distinct subtree (equal bytes of data
+    and equal children) is stored only once, so equal subtrees are the same node,
+    and they are compared by comparing pointers.
+    Nodes are immutable and may have any number of parents, so parent links and levels
+    of them are not used (only child links and data are meaningful). Every node has
+    a reference counter (see tree_persist.h), which counts links from its parents and
+    references of the user: each node, returned by tree_dag_node() or tree_dag_intern(),
+    must be given back by tree_dag_release(). Node is freed, when nobody uses it.
+    To change a subtree, expand it into an ordinary tree by tree_dag_expand().
+*/
+
+//! @attention ONLY FOR INTERNAL USE!
+struct TreeDagSlot
+{
+    TreeNode *node  = NULL;
+    size_t hash     = 0;
+};
+
+struct TreeDag
+{
+    Tree tree = {};     //< Keeps the allocator and the data size, its own root is always NULL.
+
+    //! @brief Hash table of all nodes (open addressing, linear probing),
+    //! keyed by data and child links of the node.
+    TreeDagSlot *slots  = NULL;
+    size_t slots_cap    = 0;    //< Power of 2, or 0.
+
+    size_t nodes_count  = 0;    //< Number of distinct nodes.
+};
+
+//! @brief Constructs empty DAG for data of 'data_size_in_bytes' bytes.
+TreeStatus tree_dag_ctor( TreeDag *dag_ptr, size_t data_size_in_bytes, size_t typical_num_of_nodes );
+
+//! @brief Frees all nodes of the DAG, even if they are still used.
+TreeStatus tree_dag_dtor( TreeDag *dag_ptr );
+
+//! @brief Writes by 'node_ptr' the node with given data and children
+//! (which must be nodes of the DAG or NULL), creating it if there is no such node yet.
+//! The user gets a new reference to the node.
+TreeStatus tree_dag_node( TreeDag *dag_ptr, const void *data, TreeNode *left, TreeNode *right, TreeNode **node_ptr );
+
+//! @brief Gives back the reference to the node, which was got from
+//! tree_dag_node() or tree_dag_intern().
+TreeStatus tree_dag_release( TreeDag *dag_ptr, TreeNode *node_ptr );
+
+//! @brief Puts the subtree of an ordinary tree into the DAG, sharing all of its
+//! subtrees, which are already there, and writes the node of its root by 'node_ptr'.
+//! The user gets a new reference to the node.
+//! @note Data sizes of 'src' and of the DAG must be equal.
+TreeStatus tree_dag_intern( TreeDag *dag_ptr, const Tree *src, TreeNode *subtree, TreeNode **node_ptr );
+
+//! @brief Copies the subtree of the DAG, starting with 'node_ptr', into EMPTY tree 'dest'
+//! as an ordinary tree (shared subtrees are copied as many times as they are used).
+//! @note If error happens, 'dest' is left empty.
+TreeStatus tree_dag_expand( const TreeDag *dag_ptr, const TreeNode *node_ptr, Tree *dest );
+
+#endif /* TREE_DAG_H */
@@ -1,4 +1,6 @@
 #include "tree_dump.h"
+#include "tree_iter.h"
+#include "tree_alloc.h"
 
 #include <string.h>
 #include <assert.h>
@@ -6,54 +8,192 @@
 #include <time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 #include <unistd.h>
+#include <spawn.h>
+
+extern char **environ;
 
 
 #ifdef TREE_DO_DUMP
-inline int verify_check_nodes_count( const Tree *tree_ptr )
+//! @brief Nodes of the tree are walked through live blocks of its allocator, unless
+//! the tree has no allocator (it is an image) or has snapshots (then live blocks
+//! include nodes of snapshots, see tree_persist.h). Such trees are walked from
+//! the root, so their loose nodes are not met.
+inline bool walk_by_alloc( const Tree *tree_ptr )
 {
-    assert(tree_ptr);
+    return tree_ptr->alloc && tree_ptr->snapshots_count == 0;
+}
 
-    size_t nodes_count = 0;
-    TreeNode *curr_node = tree_ptr->head_of_all_nodes;
+inline TreeNode *walk_first( const Tree *tree_ptr )
+{
+    return ( walk_by_alloc( tree_ptr ) ? _tree_alloc_first_live( tree_ptr->alloc ) : tree_ptr->root );
+}
 
-    while (curr_node != NULL)
-    {
-        nodes_count++;
-        curr_node = curr_node->next;
-    }
+inline TreeNode *walk_next( const Tree *tree_ptr, const TreeNode *curr )
+{
+    return ( walk_by_alloc( tree_ptr ) ? _tree_alloc_next_live( tree_ptr->alloc, curr )
+                                       : tree_preorder_next( curr, tree_ptr->root ) );
+}
+
+//! @brief Results of the walk over all nodes.
+struct VerifyScan
+{
+    bool count_matches      = true;
+    size_t listed_count     = 0;
+    size_t null_data_count  = 0;
+    size_t bad_links_count  = 0;
+    size_t bad_levels_count = 0;
+    bool level_hist_matches = true;
+};
+
+//! @brief Checks links of the node with its children and its parent.
+inline int verify_node_links( const Tree *tree_ptr, const TreeNode *node_ptr )
+{
+    TreeNode *left      = tree_node_left(node_ptr);
+    TreeNode *right     = tree_node_right(node_ptr);
+    TreeNode *parent    = tree_node_parent(node_ptr);
+
+    if ( left && left == right )
+        return 0;
+    if ( left && tree_node_parent(left) != node_ptr )
+        return 0;
+    if ( right && tree_node_parent(right) != node_ptr )
+        return 0;
 
-    return nodes_count == tree_ptr->nodes_count;
+    // node without parent is the root or a loose node
+    if ( parent && tree_node_left(parent) != node_ptr && tree_node_right(parent) != node_ptr )
+        return 0;
+    if ( parent && tree_ptr->root == node_ptr )
+        return 0;
+
+    return 1;
 }
 
-inline int verify_check_nodes_data_pointer( const Tree *tree_ptr )
+//! @brief Checks levels of children of the node.
+inline int verify_node_levels( const TreeNode *node_ptr )
+{
+    size_t child_level = tree_node_level(node_ptr) + 1;
+
+    TreeNode *left  = tree_node_left(node_ptr);
+    TreeNode *right = tree_node_right(node_ptr);
+
+    return ( !left  || tree_node_level(left)  == child_level )
+        && ( !right || tree_node_level(right) == child_level );
+}
+
+//! @brief Walks all nodes once (see walk_first()). On TREE_VERIFY_DEEP level also checks
+//! every link between nodes from both ends and levels of children of every node.
+//! If all of them are right, there are no cycles: a node can't be a descendant
+//! of itself, because levels grow by one along every child link.
+//! @note The walk stops after nodes_count + 1 nodes, so broken links
+//! can't make it endless.
+inline void verify_scan( const Tree *tree_ptr, TreeVerifyLevel level, VerifyScan *scan )
 {
     assert(tree_ptr);
+    assert(scan);
 
-    TreeNode *curr_node = tree_ptr->head_of_all_nodes;
+    bool deep = ( level >= TREE_VERIFY_DEEP );
 
-    while (curr_node != NULL)
+    // images (trees without allocator) don't keep level_hist
+    size_t *level_counts = NULL;
+    if ( deep && tree_ptr->alloc && tree_ptr->nodes_count != 0 )
     {
-        if (!curr_node->data_ptr)
-            return 0;
-        curr_node = curr_node->next;
+        level_counts = (size_t *) calloc( tree_ptr->depth + 1, sizeof(size_t) );
+        if (!level_counts)
+            scan->level_hist_matches = false;
     }
-    return 1;
+
+    for ( TreeNode *curr = walk_first( tree_ptr );
+          curr && scan->listed_count <= tree_ptr->nodes_count;
+          curr = walk_next( tree_ptr, curr ) )
+    {
+        scan->listed_count++;
+
+        if ( !tree_node_data(curr) )
+            scan->null_data_count++;
+
+        if (!deep)
+            continue;
+
+        if ( !verify_node_links( tree_ptr, curr ) )
+            scan->bad_links_count++;
+
+        if ( !verify_node_levels( curr ) )
+            scan->bad_levels_count++;
+
+        if ( tree_node_level(curr) > tree_ptr->depth )
+            scan->bad_levels_count++;
+        else if ( level_counts )
+            level_counts[ tree_node_level(curr) ]++;
+    }
+
+    // loose nodes are not met, if the tree is walked from the root
+    bool all_met = walk_by_alloc( tree_ptr );
+
+    if ( all_met )
+        scan->count_matches = ( scan->listed_count == tree_ptr->nodes_count );
+    else
+        scan->count_matches = ( scan->listed_count <= tree_ptr->nodes_count );
+
+    if ( level_counts && scan->level_hist_matches )
+    {
+        for (size_t ind = 0; ind <= tree_ptr->depth; ind++)
+        {
+            if ( ind >= tree_ptr->level_hist_cap
+              || level_counts[ind] > tree_ptr->level_hist[ind]
+              || ( all_met && level_counts[ind] != tree_ptr->level_hist[ind] ) )
+                scan->level_hist_matches = false;
+        }
+    }
+
+    free( level_counts );
 }
 
-#define DEF_TREE_VERIFY_FLAG(name, message, cond) {if ((cond)) {verify_res |= (tree_verify_t) (1 << (bit));} bit++;}
-tree_verify_t tree_verify( const Tree *tree_ptr )
+#define DEF_TREE_VERIFY_FLAG(name, message, flag_level, cond)   \
+    {                                                           \
+        if ( (flag_level) <= level && (cond) )                  \
+            verify_res |= (tree_verify_t) 1 << bit;             \
+        bit++;                                                  \
+    }
+tree_verify_t tree_verify_level( const Tree *tree_ptr, TreeVerifyLevel level )
 {
     tree_verify_t verify_res = 0;
 
     int bit = 0;
 
+    VerifyScan scan = {};
+    if ( tree_ptr && level >= TREE_VERIFY_FULL )
+        verify_scan( tree_ptr, level, &scan );
+
     #include "tree_verify_flags.h"
 
     return verify_res;
 }
 #undef DEF_TREE_VERIFY_FLAG
 
+tree_verify_t tree_verify( const Tree *tree_ptr )
+{
+    return tree_verify_level( tree_ptr, TREE_VERIFY_FULL );
+}
+
+TreeVerifyLevel _tree_selfcheck_level( const Tree *tree_ptr )
+{
+    if ( !tree_ptr )
+        return TREE_VERIFY_CHEAP;
+
+    // counter may be increased by several readers of the tree at once
+    size_t calls = __atomic_fetch_add( &tree_ptr->selfcheck_calls, 1, __ATOMIC_RELAXED );
+    if ( calls % TREE_SELFCHECK_PERIOD != 0 )
+        return TREE_VERIFY_CHEAP;
+
+#ifdef TREE_SELFCHECK_DEEP
+    return TREE_VERIFY_DEEP;
+#else
+    return TREE_VERIFY_FULL;
+#endif
+}
+
 void tree_print_verify_res(FILE *stream, tree_verify_t verify_res)
 {
     fprintf(stream, "Tree verification result: <%lu>\n", verify_res);
@@ -201,17 +341,39 @@ inline TreeStatus create_tmp_dot_file_( const char *dot_file_path, FILE **ret_pt
     if ( !(*ret_ptr) )
         return TREE_STATUS_ERROR_CANT_OPEN_DUMP_FILE;
 
+    // big trees give files of many megabytes, so they are written by big chunks
+    // (if the buffer can't be allocated, the default one is used)
+    setvbuf( *ret_ptr, NULL, _IOFBF, TREE_DUMP_BUFFER_SIZE );
+
     return TREE_STATUS_OK;
 }
 
+//! @brief Returns the node, going after 'curr' among the dumped nodes: either all nodes
+//! of the tree (if 'subtree' is NULL), or nodes of 'subtree' in preorder, which are
+//! not deeper than 'max_depth' levels below it.
+inline const TreeNode *dump_next( const Tree *tree_ptr, const TreeNode *subtree, size_t max_depth, const TreeNode *curr )
+{
+    if ( !subtree )
+        return walk_next( tree_ptr, curr );
+
+    if ( tree_node_level(curr) - tree_node_level(subtree) >= max_depth )
+        return tree_preorder_skip( curr, subtree );
+
+    return tree_preorder_next( curr, subtree );
+}
+
+//! @brief Writes nodes, chosen by dump_next(), and edges between them. Nodes are named
+//! by their addresses, so every edge is written as soon as its parent is met, O(n) in total.
 inline TreeStatus write_dot_file_for_dump_( FILE *dot_file,
                                             const Tree *tree_ptr,
+                                            const TreeNode *subtree,
+                                            size_t max_depth,
                                             tree_verify_t verify_res,
                                             const char *called_from_file,
                                             const int called_from_line,
                                             const char *called_from_func )
 {
-    // писать сразу в файл медленно, но когда генерится дамп, эта скорость не важна
+    // файл пишется через большой буфер (см. create_tmp_dot_file_), поэтому fprintf на каждое поле не страшен
 
 #define COLOR_BG            "#2D4059"
 #define COLOR_NODE_COLOR    "#ECC237"
@@ -237,7 +399,7 @@ inline TreeStatus write_dot_file_for_dump_( FILE *dot_file,
                         "label = \"");
     fprintf(dot_file,   "Tree[%p] (%s) declared in %s(%d), in function %s.\\n"
                         "TREE_DUMP() called from %s(%d), from function %s.\\n"
-                        "data_size: %lu; nodes_count: %lu;\\nroot: [%p];head_of_all_nodes: [%p].\\n"
+                        "data_size: %lu; nodes_count: %lu;\\nroot: [%p].\\n"
                         "depth: %lu\\n",
                         tree_ptr,
                         tree_ptr->orig_info.name,
@@ -250,82 +412,59 @@ inline TreeStatus write_dot_file_for_dump_( FILE *dot_file,
                         tree_ptr->data_size,
                         tree_ptr->nodes_count,
                         tree_ptr->root,
-                        tree_ptr->head_of_all_nodes,
                         tree_ptr->depth);
     tree_print_verify_res(dot_file, verify_res);
     fprintf(dot_file, "\"]\n\n\n");
 
 
-    // Nodes with data
-    TreeNode *curr_node = tree_ptr->head_of_all_nodes;
-    TreeNode **nodes_arr = (TreeNode**) calloc( tree_ptr->nodes_count, sizeof(TreeNode) );
-    for (size_t ind = 0; ind < tree_ptr->nodes_count; ind++)
+    // Nodes with data and edges
+    const TreeNode *first = ( subtree ? subtree : walk_first( tree_ptr ) );
+    for ( const TreeNode *curr_node = first; curr_node;
+          curr_node = dump_next( tree_ptr, subtree, max_depth, curr_node ) )
     {
-        if ( curr_node == NULL )
-        {
-            fprintf(stderr, "ERROR: something wrong with listing of nodes!\n");
-            break;
-        }
-
-        fprintf(dot_file,   "NODE_%lu[shape=\"record\", fontname=\"verdana\",\n"
+        fprintf(dot_file,   "NODE_%p[shape=\"record\", fontname=\"verdana\",\n"
                             "style=bold, style=filled,\n"
                             "color=\"" COLOR_NODE_COLOR "\", fillcolor=\"" COLOR_NODE_FILL "\",\n"
                             "label = <<table cellspacing=\"0\">\n"
                             "<tr><td colspan=\"2\">address: [%p]</td></tr>\n"
                             "<tr><td colspan=\"2\">level: %lu</td></tr>\n"
                             "<tr><td colspan=\"2\">data: ",
-                            ind,
-                            curr_node,
-                            curr_node->level);
-        tree_ptr->print_data_func_ptr(dot_file, curr_node->data_ptr);
+                            (const void *) curr_node,
+                            (const void *) curr_node,
+                            tree_node_level(curr_node));
+        tree_ptr->print_data_func_ptr(dot_file, tree_node_data(curr_node));
         fprintf(dot_file,   "</td></tr>\n"
-                            "<tr><td>left: [%p]</td><td>right: [%p]</td></tr>\n"
-                            "<tr><td>prev: [%p]</td><td>next: [%p]</td></tr></table>>];\n\n",
-                            curr_node->left,
-                            curr_node->right,
-                            curr_node->prev,
-                            curr_node->next);
-
-        nodes_arr[ind] = curr_node;
-        curr_node = curr_node->next;
-    }
+                            "<tr><td>left: [%p]</td><td>right: [%p]</td></tr></table>>];\n",
+                            (void *) tree_node_left(curr_node),
+                            (void *) tree_node_right(curr_node));
 
+        TreeNode *left  = tree_node_left(curr_node);
+        TreeNode *right = tree_node_right(curr_node);
 
-    // Edges
-    for (size_t ind = 0; ind < tree_ptr->nodes_count; ind++)
-    {
-        size_t left = 0;
-        size_t right = 0;
-        for (size_t i = 0; i < tree_ptr->nodes_count; i++)
+        // children of the nodes on the depth limit are not dumped, they are shown as one mark
+        if ( subtree && tree_node_level(curr_node) - tree_node_level(subtree) >= max_depth )
         {
-            if ( nodes_arr[i] == nodes_arr[ind]->left )
-            {
-                left = i;
-            }
-            else if ( nodes_arr[i] == nodes_arr[ind]->right )
-            {
-                right = i;
-            }
+            if ( left || right )
+                fprintf(dot_file,   "NODE_%p_CUT[shape=plaintext, fontcolor=\"" COLOR_EDGE "\", label=\"...\"];\n"
+                                    "NODE_%p->NODE_%p_CUT[color=\"" COLOR_EDGE "\", style=dashed];\n\n",
+                                    (const void *) curr_node, (const void *) curr_node, (const void *) curr_node);
+            continue;
         }
 
-        if ( nodes_arr[ind]->left )
-        {
-            fprintf(dot_file,   "NODE_%lu->NODE_%lu[color=\"" COLOR_EDGE_LEFT "\", penwidth=2];\n",
-                                ind, left);
-        }
+        if ( left )
+            fprintf(dot_file,   "NODE_%p->NODE_%p[color=\"" COLOR_EDGE_LEFT "\", penwidth=2];\n",
+                                (const void *) curr_node, (void *) left);
 
-        if ( nodes_arr[ind]->right )
-        {
-            fprintf(dot_file,   "NODE_%lu->NODE_%lu[color=\"" COLOR_EDGE_RIGHT "\", penwidth=2];\n",
-                                ind, right);
-        }
+        if ( right )
+            fprintf(dot_file,   "NODE_%p->NODE_%p[color=\"" COLOR_EDGE_RIGHT "\", penwidth=2];\n",
+                                (const void *) curr_node, (void *) right);
 
-        if ( nodes_arr[ind]->left && nodes_arr[ind]->right )
-        {
-            fprintf(dot_file,   "NODE_%lu->NODE_%lu[style=invis];\n"
-                                "{rank=same NODE_%lu NODE_%lu}",
-                                left, right, left, right);
-        }
+        if ( left && right )
+            fprintf(dot_file,   "NODE_%p->NODE_%p[style=invis];\n"
+                                "{rank=same NODE_%p NODE_%p}\n",
+                                (void *) left, (void *) right, (void *) left, (void *) right);
+
+        fprintf(dot_file, "\n");
     }
 
 
@@ -343,32 +482,29 @@ inline TreeStatus write_dot_file_for_dump_( FILE *dot_file,
 #undef COLOR_EDGE_NEXT
 #undef COLOR_EDGE_FREE
 
-    free(nodes_arr);
-
     return TREE_STATUS_OK;
 }
 
+//! @brief Starts 'dot' in a detached process and returns at once: the shell, spawned
+//! here, starts 'dot' in background and exits, so only the shell is waited for,
+//! and 'dot' doesn't become a zombie. Paths are given to the shell as arguments,
+//! so they aren't parsed by it.
 inline TreeStatus generate_dump_img_( const char * dump_dot_path, const char * dump_img_path )
 {
-    char cmd[TREE_MAX_CMD_GEN_DUMP_IMG_LENGHT] = {};
-    int written_chars = snprintf(   cmd,
-                                    TREE_MAX_CMD_GEN_DUMP_IMG_LENGHT,
-                                    "dot %s -Tjpg -o %s",
-                                    dump_dot_path,
-                                    dump_img_path);
-
-    if ( written_chars >= (int) TREE_MAX_CMD_GEN_DUMP_IMG_LENGHT)
-    {
-        fprintf(stderr, "Command to generate dump image is too long, can't execute it. "
-        "Please, make paths to files shorter.\n");
-        return TREE_STATUS_ERROR_TOO_LONG_CMD_GEN_DUMP_IMG;
-    }
-
-    int res = system(cmd);
-
-    if (res == 0) 
-        fprintf(stderr, "Tree dump image is generated!\n");
-    else    
+    char sh[]       = "sh";
+    char sh_opt[]   = "-c";
+    char sh_cmd[]   = "dot \"$0\" -Tjpg -o \"$1\" >/dev/null 2>&1 &";
+    char *argv[] = { sh, sh_opt, sh_cmd,
+                     const_cast<char *>(dump_dot_path), const_cast<char *>(dump_img_path), NULL };
+
+    pid_t pid = 0;
+    int res = posix_spawn( &pid, "/bin/sh", NULL, NULL, argv, environ );
+    if ( res == 0 )
+        res = ( waitpid( pid, NULL, 0 ) == pid ? 0 : -1 );
+
+    if (res == 0)
+        fprintf(stderr, "Tree dump image is being generated: %s\n", dump_img_path);
+    else
         fprintf(stderr, "ERROR: Something went wrong during an attempt to call 'dot'.\n");
 
     return TREE_STATUS_OK;
@@ -382,37 +518,55 @@ inline TreeStatus free_dot_file_( FILE * dot_tmp_file )
 }
 
 
-void tree_dump_( const Tree *tree_ptr,
-                 tree_verify_t verify_res,
-                 const char *file,
-                 const int line,
-                 const char *func)
+void tree_dump_subtree_( const Tree *tree_ptr,
+                         const TreeNode *subtree,
+                         size_t max_depth,
+                         tree_verify_t verify_res,
+                         const char *file,
+                         const int line,
+                         const char *func)
 {
     FILE *dot_file = NULL;
 
     char *curr_dump_dir = NULL;
     WRP_PRINT( create_dump_folder_(&curr_dump_dir) );
 
+    // several dumps can be made in one second, each of them gets its own files
+    static size_t dumps_count = 0;
+    size_t dump_id = __atomic_fetch_add( &dumps_count, 1, __ATOMIC_RELAXED );
+
     char dot_file_path[TREE_MAX_DUMP_PATH_LENGHT] = "";
-    strncpy(dot_file_path, curr_dump_dir, TREE_MAX_DUMP_PATH_LENGHT);
-    strncat(dot_file_path, "dmp.dot", TREE_MAX_DUMP_PATH_LENGHT - strlen(dot_file_path));
+    char img_file_path[TREE_MAX_DUMP_PATH_LENGHT] = "";
+    int dot_len = snprintf( dot_file_path, TREE_MAX_DUMP_PATH_LENGHT, "%sdmp_%lu.dot", curr_dump_dir, dump_id );
+    int img_len = snprintf( img_file_path, TREE_MAX_DUMP_PATH_LENGHT, "%sdmp_%lu.jpg", curr_dump_dir, dump_id );
+    free(curr_dump_dir);
+    if ( dot_len < 0 || dot_len >= (int) TREE_MAX_DUMP_PATH_LENGHT
+      || img_len < 0 || img_len >= (int) TREE_MAX_DUMP_PATH_LENGHT )
+    {
+        tree_print_status_message( stderr, TREE_STATUS_ERROR_MAX_DUMP_PATH_LEN_TOO_SHORT );
+        return;
+    }
 
     WRP_PRINT( create_tmp_dot_file_( dot_file_path, &dot_file ) );
 
-    WRP_PRINT( write_dot_file_for_dump_(dot_file, tree_ptr, verify_res, file, line, func ) );
-
-    WRP_PRINT( free_dot_file_(dot_file) );
-
-    char img_file_path[TREE_MAX_DUMP_PATH_LENGHT] = "";
-    strncpy(img_file_path, curr_dump_dir, TREE_MAX_DUMP_PATH_LENGHT);
-    strncat(img_file_path, "dmp.jpg", TREE_MAX_DUMP_PATH_LENGHT - strlen(img_file_path));
+    TreeStatus status = write_dot_file_for_dump_( dot_file, tree_ptr, subtree, max_depth,
+                                                  verify_res, file, line, func );
+    free_dot_file_(dot_file);
+    WRP_PRINT( status );
 
     WRP_PRINT( generate_dump_img_( dot_file_path, img_file_path ) );
 
-    free(curr_dump_dir);
-
 #ifdef TREE_ABORT_ON_DUMP
     abort();
 #endif
 }
+
+void tree_dump_( const Tree *tree_ptr,
+                 tree_verify_t verify_res,
+                 const char *file,
+                 const int line,
+                 const char *func)
+{
+    tree_dump_subtree_( tree_ptr, NULL, SIZE_MAX, verify_res, file, line, func );
+}
 #endif /* TREE_DO_DUMP */
@@ -7,7 +7,19 @@
 #ifdef TREE_DO_DUMP
     const mode_t MKDIR_MODE = 0777;
 
+    //! @brief Verifies the tree on the TREE_VERIFY_FULL level.
     tree_verify_t tree_verify( const Tree *tree_ptr );
+
+    //! @brief Returns flags (see tree_verify_flags.h) of all problems, found by checks
+    //! of given 'level' and of lower levels. Every level takes O(1) additional memory
+    //! (except TREE_VERIFY_DEEP, which needs an array of depth + 1 counters).
+    tree_verify_t tree_verify_level( const Tree *tree_ptr, TreeVerifyLevel level );
+
+    //! @attention ONLY FOR INTERNAL USE!
+    //! @brief Returns the level of verification for the next TREE_SELFCHECK()
+    //! (see TREE_SELFCHECK_PERIOD).
+    TreeVerifyLevel _tree_selfcheck_level( const Tree *tree_ptr );
+
     void tree_print_verify_res(FILE *stream, tree_verify_t verify_res);
     void tree_dump_( const Tree *tree_ptr,
                     tree_verify_t verify_res,
@@ -15,27 +27,48 @@
                     const int line,
                     const char *func);
 
+    //! @brief Dumps only nodes of 'subtree', which are not deeper than 'max_depth' levels
+    //! below it (0 means only 'subtree' itself); cut children are shown as "...".
+    void tree_dump_subtree_( const Tree *tree_ptr,
+                             const TreeNode *subtree,
+                             size_t max_depth,
+                             tree_verify_t verify_res,
+                             const char *file,
+                             const int line,
+                             const char *func);
+
     #define TREE_DUMP( tree_ptr, verify_res ) tree_dump_( tree_ptr,     \
                                                           verify_res,   \
                                                           __FILE__,     \
                                                           __LINE__,     \
                                                           __func__ )
 
+    #define TREE_DUMP_SUBTREE( tree_ptr, subtree, max_depth )                   \
+        tree_dump_subtree_( tree_ptr,                                           \
+                            subtree,                                            \
+                            max_depth,                                          \
+                            tree_verify( tree_ptr ),                            \
+                            __FILE__,                                           \
+                            __LINE__,                                           \
+                            __func__ )
+
 
-    #define TREE_SELFCHECK( tree_ptr ) {                        \
-        tree_verify_t verify_res = tree_verify( tree_ptr );     \
-        if ( verify_res != 0 )                                  \
-        {                                                       \
-            TREE_DUMP( tree_ptr, verify_res );                  \
-            return TREE_STATUS_ERROR_VERIFY;                    \
-        }                                                       \
+    #define TREE_SELFCHECK( tree_ptr ) {                                 \
+        tree_verify_t verify_res = tree_verify_level( tree_ptr,          \
+                                    _tree_selfcheck_level( tree_ptr ) ); \
+        if ( verify_res != 0 )                                           \
+        {                                                                \
+            TREE_DUMP( tree_ptr, verify_res );                           \
+            return TREE_STATUS_ERROR_VERIFY;                             \
+        }                                                                \
     }
 
     void tree_print_status_message( FILE *stream, TreeStatus status );
 
 #else /* NOT TREE_DO_DUMP */
     #define TREE_DUMP( tree_ptr, verify_res ) ((void) 0)
-    #define TREE_SELFCHECK( tree_ptr ) ((void) 0)
+    #define TREE_DUMP_SUBTREE( tree_ptr, subtree, max_depth ) ((void) 0)
+    #define TREE_SELFCHECK( tree_ptr ) ((void) (tree_ptr))
 #endif /* TREE_DO_DUMP */
 
 //! @brief call tree_func, returning TreeStatus, and if
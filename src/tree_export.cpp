@@ -0,0 +1,210 @@
+#include "tree.h"
+
+#include <assert.h>
+#include <stdlib.h>
+
+
+const size_t NO_ID = SIZE_MAX;
+
+//! @brief Number of data bytes, written as hex digits by one fwrite().
+const size_t HEX_CHUNK_SIZE = 64;
+
+//! @brief Walks the tree once and calls row( node, id, parent_id, left_id, right_id )
+//! for every node, when its subtree is walked (NO_ID if there is no such node).
+//! @details Nodes are numbered in preorder, ids[level] is the id of the last node
+//! of this level, met by the walk. When a node is finished, ids[level - 1] is its parent,
+//! ids[level + 1] is its right child (which is the last node of the next level
+//! in its subtree), and the left child always goes right after the node.
+template <typename RowFunc>
+inline TreeStatus export_walk( const Tree *tree_ptr, RowFunc row )
+{
+    const TreeNode *root = tree_ptr->root;
+    if ( !root )
+        return TREE_STATUS_OK;
+
+    size_t *ids = (size_t *) calloc( tree_ptr->depth + 2, sizeof(size_t) );
+    if (!ids)
+        return TREE_STATUS_ERROR_MEM_ALLOC;
+
+    // nodes from 'last' up to the node of 'min_level' are finished
+    auto finish = [&]( const TreeNode *last, size_t min_level )
+    {
+        for ( const TreeNode *curr = last; curr && tree_node_level(curr) >= min_level;
+              curr = tree_node_parent(curr) )
+        {
+            size_t level = tree_node_level(curr);
+            size_t id    = ids[level];
+
+            row(    curr, id,
+                    ( curr == root          ? NO_ID : ids[level - 1] ),
+                    ( tree_node_left(curr)  ? id + 1 : NO_ID ),
+                    ( tree_node_right(curr) ? ids[level + 1] : NO_ID ) );
+
+            if ( curr == root )
+                break;
+        }
+    };
+
+    size_t next_id = 0;
+    const TreeNode *prev = NULL;
+    for ( const TreeNode *curr = root; curr; curr = tree_preorder_next( curr, root ) )
+    {
+        size_t level = tree_node_level(curr);
+        assert( level <= tree_ptr->depth );
+
+        if (prev)
+            finish( prev, level );
+
+        ids[level] = next_id++;
+        prev = curr;
+    }
+    finish( prev, 0 );
+
+    free(ids);
+
+    return TREE_STATUS_OK;
+}
+
+inline void print_data( FILE *stream, const Tree *tree_ptr, const TreeNode *node_ptr,
+                        tree_export_data_func_t print_data_func_ptr )
+{
+    void *data_ptr = tree_node_data( node_ptr );
+
+    if ( print_data_func_ptr )
+    {
+        print_data_func_ptr( stream, data_ptr );
+        return;
+    }
+
+    // hex digits are written by chunks, not by one fprintf() per byte
+    const char digits[] = "0123456789abcdef";
+    char chunk[2 * HEX_CHUNK_SIZE] = {};
+
+    const unsigned char *bytes = (const unsigned char *) data_ptr;
+    for (size_t start = 0; start < tree_ptr->data_size; start += HEX_CHUNK_SIZE)
+    {
+        size_t len = tree_ptr->data_size - start;
+        if ( len > HEX_CHUNK_SIZE )
+            len = HEX_CHUNK_SIZE;
+
+        for (size_t ind = 0; ind < len; ind++)
+        {
+            chunk[2 * ind]      = digits[ bytes[start + ind] >> 4 ];
+            chunk[2 * ind + 1]  = digits[ bytes[start + ind] & 0xF ];
+        }
+
+        fwrite( chunk, sizeof(char), 2 * len, stream );
+    }
+}
+
+inline void print_json_id( FILE *stream, size_t id )
+{
+    if ( id == NO_ID )
+        fputs( "null", stream );
+    else
+        fprintf( stream, "%zu", id );
+}
+
+inline long long flat_id( size_t id )
+{
+    return ( id == NO_ID ? -1 : (long long) id );
+}
+
+inline TreeStatus stream_status( FILE *stream, TreeStatus walk_status )
+{
+    if ( walk_status != TREE_STATUS_OK )
+        return walk_status;
+
+    return ( ferror( stream ) ? TREE_STATUS_ERROR_FILE_IO : TREE_STATUS_OK );
+}
+
+TreeStatus tree_export_json( const Tree *tree_ptr, FILE *stream,
+                             tree_export_data_func_t print_data_func_ptr )
+{
+    TREE_SELFCHECK(tree_ptr);
+    assert(stream);
+
+    // loose nodes aren't exported, so they aren't counted (ids are numbers of walked nodes)
+    fprintf( stream, "{\"data_size\":%zu,\"nodes_count\":%zu,\"nodes\":[",
+             tree_ptr->data_size, tree_subtree_size( tree_ptr->root ) );
+
+    bool first = true;
+    TreeStatus status = export_walk( tree_ptr,
+        [&]( const TreeNode *node_ptr, size_t id, size_t parent, size_t left, size_t right )
+        {
+            fprintf( stream, "%s\n{\"id\":%zu,\"parent\":", ( first ? "" : "," ), id );
+            print_json_id( stream, parent );
+            fputs( ",\"left\":", stream );
+            print_json_id( stream, left );
+            fputs( ",\"right\":", stream );
+            print_json_id( stream, right );
+            fputs( ",\"data\":", stream );
+            if ( print_data_func_ptr )
+                print_data( stream, tree_ptr, node_ptr, print_data_func_ptr );
+            else
+            {
+                fputc( '"', stream );
+                print_data( stream, tree_ptr, node_ptr, NULL );
+                fputc( '"', stream );
+            }
+            fputc( '}', stream );
+
+            first = false;
+        } );
+
+    fputs( "\n]}\n", stream );
+
+    return stream_status( stream, status );
+}
+
+TreeStatus tree_export_graphml( const Tree *tree_ptr, FILE *stream,
+                                tree_export_data_func_t print_data_func_ptr )
+{
+    TREE_SELFCHECK(tree_ptr);
+    assert(stream);
+
+    fputs(  "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+            "<graphml xmlns=\"http://graphml.graphdrawing.org/xmlns\">\n"
+            "<key id=\"data\" for=\"node\" attr.name=\"data\" attr.type=\"string\"/>\n"
+            "<key id=\"side\" for=\"edge\" attr.name=\"side\" attr.type=\"string\"/>\n"
+            "<graph id=\"tree\" edgedefault=\"directed\">\n", stream );
+
+    TreeStatus status = export_walk( tree_ptr,
+        [&]( const TreeNode *node_ptr, size_t id, size_t, size_t left, size_t right )
+        {
+            fprintf( stream, "<node id=\"n%zu\"><data key=\"data\">", id );
+            print_data( stream, tree_ptr, node_ptr, print_data_func_ptr );
+            fputs( "</data></node>\n", stream );
+
+            if ( left != NO_ID )
+                fprintf( stream, "<edge source=\"n%zu\" target=\"n%zu\">"
+                                 "<data key=\"side\">left</data></edge>\n", id, left );
+            if ( right != NO_ID )
+                fprintf( stream, "<edge source=\"n%zu\" target=\"n%zu\">"
+                                 "<data key=\"side\">right</data></edge>\n", id, right );
+        } );
+
+    fputs( "</graph>\n</graphml>\n", stream );
+
+    return stream_status( stream, status );
+}
+
+TreeStatus tree_export_flat( const Tree *tree_ptr, FILE *stream,
+                             tree_export_data_func_t print_data_func_ptr )
+{
+    TREE_SELFCHECK(tree_ptr);
+    assert(stream);
+
+    fputs( "id\tparent\tleft\tright\tdata\n", stream );
+
+    TreeStatus status = export_walk( tree_ptr,
+        [&]( const TreeNode *node_ptr, size_t id, size_t parent, size_t left, size_t right )
+        {
+            fprintf( stream, "%zu\t%lld\t%lld\t%lld\t", id,
+                     flat_id( parent ), flat_id( left ), flat_id( right ) );
+            print_data( stream, tree_ptr, node_ptr, print_data_func_ptr );
+            fputc( '\n', stream );
+        } );
+
+    return stream_status( stream, status );
+}
@@ -0,0 +1,45 @@
+#ifndef TREE_EXPORT_H
+#define TREE_EXPORT_H
+
+#include "tree_common.h"
+
+/*
+    Text exports of trees for other tools. They work in all builds (unlike dumps).
+    Every node gets id - its number in preorder (root is 0). Each exporter walks
+    the tree once, and writes a node as soon as its whole subtree is walked (so
+    nodes go in postorder, but every of them has its id, ids of its parent and children).
+    Only ids of nodes of the current path are kept, so memory is O(depth).
+    Loose nodes are not exported.
+
+    Data of a node is written by 'print_data_func_ptr' (same as for tree_ctor() in
+    TREE_DO_DUMP mode), which must write a value, valid for the format
+    (JSON value, XML text or text without tabs and line breaks). If it is NULL,
+    data bytes are written as a string of hex digits.
+
+    Formats:
+    - JSON: { "data_size": N, "nodes_count": N, "nodes": [ { "id": N, "parent": N,
+      "left": N, "right": N, "data": <data> }, ... ] }, with null for missing nodes
+      ("nodes_count" is the length of "nodes", so loose nodes are not counted);
+    - GraphML: every node has key "data", and every edge from a parent to a child
+      has key "side" ("left" or "right");
+    - flat: tab-separated table with the header "id parent left right data",
+      with -1 for missing nodes. Sorted by id, columns are flat arrays
+      of parents, left and right children and data.
+*/
+
+//! @brief Writes data of the node into the stream (see above).
+typedef void (*tree_export_data_func_t)(FILE *stream, void *data_ptr);
+
+//! @brief Writes the tree into the stream as JSON.
+TreeStatus tree_export_json( const Tree *tree_ptr, FILE *stream,
+                             tree_export_data_func_t print_data_func_ptr = NULL );
+
+//! @brief Writes the tree into the stream as GraphML.
+TreeStatus tree_export_graphml( const Tree *tree_ptr, FILE *stream,
+                                tree_export_data_func_t print_data_func_ptr = NULL );
+
+//! @brief Writes the tree into the stream as a tab-separated table.
+TreeStatus tree_export_flat( const Tree *tree_ptr, FILE *stream,
+                             tree_export_data_func_t print_data_func_ptr = NULL );
+
+#endif /* TREE_EXPORT_H */
@@ -0,0 +1,168 @@
+#include "tree.h"
+#include "tree_alloc.h"
+
+#include <assert.h>
+#include <memory.h>
+
+
+inline size_t *node_hash( Tree *tree_ptr, const TreeNode *node_ptr )
+{
+    return _tree_alloc_hash( tree_ptr->alloc, node_ptr );
+}
+
+inline size_t mix_hash( size_t hash )
+{
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+
+    return hash;
+}
+
+//! @brief FNV-1a of data bytes, mixed with hashes of the children (0 if there is no child).
+//! Is never 0, because 0 means that there is no cached hash.
+inline size_t combine_hash( size_t data_size, const void *data, size_t left_hash, size_t right_hash )
+{
+    size_t hash = 14695981039346656037ULL;
+
+    const unsigned char *bytes = (const unsigned char *) data;
+    for (size_t ind = 0; ind < data_size; ind++)
+    {
+        hash ^= bytes[ind];
+        hash *= 1099511628211ULL;
+    }
+
+    hash = mix_hash( hash ^ left_hash );
+    hash = mix_hash( hash + right_hash * 0x9e3779b97f4a7c15ULL );
+
+    return ( hash ? hash : 1 );
+}
+
+inline int has_hash( Tree *tree_ptr, const TreeNode *node_ptr )
+{
+    return *node_hash( tree_ptr, node_ptr ) != 0;
+}
+
+TreeStatus tree_subtree_hash( Tree *tree_ptr, TreeNode *subtree, size_t *hash_ptr )
+{
+    TREE_SELFCHECK(tree_ptr);
+    assert(subtree);
+    assert(hash_ptr);
+
+    if ( !tree_ptr->hash_cache )
+    {
+        if ( _tree_alloc_enable_hashes( tree_ptr->alloc ) != TREE_ALLOC_OK )
+            return TREE_STATUS_ERROR_MEM_ALLOC;
+        tree_ptr->hash_cache = true;
+    }
+
+    // postorder walk, which doesn't go into subtrees with cached hashes
+    TreeNode *stop = tree_node_parent(subtree);
+    TreeNode *prev = stop;
+    TreeNode *curr = ( has_hash( tree_ptr, subtree ) ? stop : subtree );
+    while ( curr != stop )
+    {
+        TreeNode *left  = tree_node_left(curr);
+        TreeNode *right = tree_node_right(curr);
+
+        TreeNode *next = NULL;
+        if ( prev == tree_node_parent(curr) && left && !has_hash( tree_ptr, left ) )
+            next = left;
+        else if ( prev != right && right && !has_hash( tree_ptr, right ) )
+            next = right;
+
+        if ( next )
+        {
+            prev = curr;
+            curr = next;
+            continue;
+        }
+
+        // hashes of both children are cached
+        *node_hash( tree_ptr, curr ) = combine_hash( tree_ptr->data_size, tree_node_data(curr),
+                                                     left  ? *node_hash( tree_ptr, left )  : 0,
+                                                     right ? *node_hash( tree_ptr, right ) : 0 );
+
+        prev = curr;
+        curr = tree_node_parent(curr);
+    }
+
+    *hash_ptr = *node_hash( tree_ptr, subtree );
+
+    return TREE_STATUS_OK;
+}
+
+TreeStatus tree_subtree_equal( Tree *tree_a, TreeNode *subtree_a,
+                               Tree *tree_b, TreeNode *subtree_b, int *equal_ptr )
+{
+    assert(subtree_a);
+    assert(subtree_b);
+    assert(equal_ptr);
+
+    if ( tree_a->data_size != tree_b->data_size )
+        return TREE_STATUS_ERROR_DATA_SIZE_MISMATCH;
+
+    size_t hash_a = 0;
+    size_t hash_b = 0;
+    WRP_RET( tree_subtree_hash( tree_a, subtree_a, &hash_a ) );
+    WRP_RET( tree_subtree_hash( tree_b, subtree_b, &hash_b ) );
+
+    *equal_ptr = 0;
+
+    // subtrees are walked in lockstep, so they have the same shape as long as all nodes have
+    // the same children; hashes of all nodes are cached now, so most differences are found at once
+    TreeNode *curr_a = subtree_a;
+    TreeNode *curr_b = subtree_b;
+    while ( curr_a )
+    {
+        if ( *node_hash( tree_a, curr_a ) != *node_hash( tree_b, curr_b ) )
+            return TREE_STATUS_OK;
+
+        if ( curr_a == curr_b )
+        {
+            // the same node (e.g. shared by versions of a persistent tree)
+            curr_a = tree_preorder_skip( curr_a, subtree_a );
+            curr_b = tree_preorder_skip( curr_b, subtree_b );
+            continue;
+        }
+
+        if ( !tree_node_left(curr_a)  != !tree_node_left(curr_b)
+          || !tree_node_right(curr_a) != !tree_node_right(curr_b)
+          || memcmp( tree_node_data(curr_a), tree_node_data(curr_b), tree_a->data_size ) != 0 )
+            return TREE_STATUS_OK;
+
+        curr_a = tree_preorder_next( curr_a, subtree_a );
+        curr_b = tree_preorder_next( curr_b, subtree_b );
+    }
+
+    *equal_ptr = 1;
+
+    return TREE_STATUS_OK;
+}
+
+void _tree_hash_invalidate( Tree *tree_ptr, TreeNode *node_ptr )
+{
+    assert(tree_ptr);
+
+    if ( !tree_ptr->hash_cache )
+        return;
+
+    // ancestors of a node without hash don't have hashes either
+    for ( TreeNode *curr = node_ptr; curr; curr = tree_node_parent(curr) )
+    {
+        size_t *hash = node_hash( tree_ptr, curr );
+        if ( *hash == 0 )
+            break;
+        *hash = 0;
+    }
+}
+
+TreeStatus tree_invalidate_hash( Tree *tree_ptr, TreeNode *node_ptr )
+{
+    TREE_SELFCHECK(tree_ptr);
+    assert(node_ptr);
+
+    _tree_hash_invalidate( tree_ptr, node_ptr );
+
+    return TREE_STATUS_OK;
+}
@@ -0,0 +1,34 @@
+#ifndef TREE_HASH_H
+#define TREE_HASH_H
+
+#include "tree_common.h"
+
+/*
+    Structural hashes of subtrees (of data bytes and shape). Hash of every node is
+    cached (in a side table of the allocator) once it is computed, and functions of tree.h,
+    which change data or children of a node, drop cached hashes of the node and of
+    its ancestors, so only changed paths are hashed again.
+    Cache is kept valid by the rule: if hash of a node is cached, hashes of all
+    its descendants are cached too, so dropping stops at the first ancestor without hash.
+*/
+
+//! @brief Writes hash of the subtree, which starts with 'subtree', by 'hash_ptr'.
+//! @note The first call turns on caching of hashes for the tree.
+TreeStatus tree_subtree_hash( Tree *tree_ptr, TreeNode *subtree, size_t *hash_ptr );
+
+//! @brief Writes 1 by 'equal_ptr' if subtrees have the same shape and equal data bytes
+//! in all nodes, and 0 otherwise. Subtrees may belong to different trees with equal data sizes.
+//! @note Subtrees with different hashes are told apart without walking them, equal
+//! subtrees are walked once (except for the shared nodes of persistent trees).
+TreeStatus tree_subtree_equal( Tree *tree_a, TreeNode *subtree_a,
+                               Tree *tree_b, TreeNode *subtree_b, int *equal_ptr );
+
+//! @brief Drops cached hashes of the node and its ancestors. Must be called after data
+//! of the node is changed through the pointer to it (see tree_get_data_ptr()).
+TreeStatus tree_invalidate_hash( Tree *tree_ptr, TreeNode *node_ptr );
+
+//! @attention ONLY FOR INTERNAL USE!
+//! @brief Same as tree_invalidate_hash(), does nothing if caching is off.
+void _tree_hash_invalidate( Tree *tree_ptr, TreeNode *node_ptr );
+
+#endif /* TREE_HASH_H */
@@ -0,0 +1,528 @@
+#include "tree.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <sys/types.h>
+
+#ifdef TREE_COMPACT_NODES
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+
+typedef unsigned char byte;
+
+static_assert( sizeof(TreeFileHeader) == 40, "TreeFileHeader mustn't have padding" );
+
+const size_t TREE_IO_SHAPE_BUF_SIZE     = 4096;
+const size_t TREE_IO_PAYLOAD_BUF_SIZE   = 65536;
+
+const unsigned SHAPE_HAS_LEFT   = 1;
+const unsigned SHAPE_HAS_RIGHT  = 2;
+const unsigned SHAPE_BITS       = 2;
+const unsigned SHAPES_PER_BYTE  = 8 / SHAPE_BITS;
+
+inline size_t shape_size_in_bytes( size_t nodes_count )
+{
+    return nodes_count / SHAPES_PER_BYTE + ( nodes_count % SHAPES_PER_BYTE != 0 );
+}
+
+//! @brief Buffered writer, flushing into the stream by big chunks.
+struct ChunkWriter
+{
+    FILE *stream    = NULL;
+    byte *buf       = NULL;
+    size_t cap      = 0;
+    size_t size     = 0;
+};
+
+inline TreeStatus writer_flush( ChunkWriter *writer )
+{
+    if ( writer->size && fwrite( writer->buf, 1, writer->size, writer->stream ) != writer->size )
+        return TREE_STATUS_ERROR_FILE_IO;
+
+    writer->size = 0;
+
+    return TREE_STATUS_OK;
+}
+
+inline TreeStatus writer_write( ChunkWriter *writer, const void *src, size_t count )
+{
+    if ( writer->size + count > writer->cap )
+        WRP_RET( writer_flush( writer ) );
+
+    if ( count > writer->cap )
+    {
+        if ( fwrite( src, 1, count, writer->stream ) != count )
+            return TREE_STATUS_ERROR_FILE_IO;
+
+        return TREE_STATUS_OK;
+    }
+
+    memcpy( writer->buf + writer->size, src, count );
+    writer->size += count;
+
+    return TREE_STATUS_OK;
+}
+
+inline TreeStatus save_shape( const Tree *tree_ptr, ChunkWriter *writer )
+{
+    byte acc = 0;
+    unsigned in_acc = 0;
+
+    TreeNode *root = tree_ptr->root;
+    for ( TreeNode *curr = root; curr; curr = tree_preorder_next( curr, root ) )
+    {
+        unsigned shape = ( tree_node_left(curr)  ? SHAPE_HAS_LEFT  : 0 )
+                       | ( tree_node_right(curr) ? SHAPE_HAS_RIGHT : 0 );
+        acc = (byte) ( acc | ( shape << (in_acc * SHAPE_BITS) ) );
+
+        if ( ++in_acc == SHAPES_PER_BYTE )
+        {
+            WRP_RET( writer_write( writer, &acc, 1 ) );
+            acc     = 0;
+            in_acc  = 0;
+        }
+    }
+
+    if ( in_acc )
+        WRP_RET( writer_write( writer, &acc, 1 ) );
+
+    return TREE_STATUS_OK;
+}
+
+inline TreeStatus save_payload( const Tree *tree_ptr, ChunkWriter *writer )
+{
+    TreeNode *root = tree_ptr->root;
+    for ( TreeNode *curr = root; curr; curr = tree_preorder_next( curr, root ) )
+        WRP_RET( writer_write( writer, tree_node_data(curr), tree_ptr->data_size ) );
+
+    return TREE_STATUS_OK;
+}
+
+TreeStatus tree_save( const Tree *tree_ptr, FILE *stream )
+{
+    TREE_SELFCHECK(tree_ptr);
+    assert(stream);
+
+    // loose nodes aren't saved, so only nodes of the root subtree are counted
+    size_t depth        = 0;
+    size_t nodes_count  = tree_subtree_size( tree_ptr->root, &depth );
+
+    TreeFileHeader header = {};
+    memcpy( header.magic, TREE_FILE_MAGIC, sizeof(TREE_FILE_MAGIC) );
+    header.version      = TREE_FILE_VERSION;
+    header.header_size  = sizeof(TreeFileHeader);
+    header.data_size    = tree_ptr->data_size;
+    header.nodes_count  = nodes_count;
+    header.depth        = depth;
+
+    if ( fwrite( &header, sizeof(header), 1, stream ) != 1 )
+        return TREE_STATUS_ERROR_FILE_IO;
+
+    ChunkWriter writer = {};
+    writer.stream   = stream;
+    writer.cap      = TREE_IO_PAYLOAD_BUF_SIZE;
+    writer.buf      = (byte *) calloc( writer.cap, 1 );
+    if (!writer.buf)
+        return TREE_STATUS_ERROR_MEM_ALLOC;
+
+    TreeStatus status = save_shape( tree_ptr, &writer );
+    if ( status == TREE_STATUS_OK )
+        status = save_payload( tree_ptr, &writer );
+    if ( status == TREE_STATUS_OK )
+        status = writer_flush( &writer );
+
+    free( writer.buf );
+
+    if ( status == TREE_STATUS_OK && fflush( stream ) != 0 )
+        return TREE_STATUS_ERROR_FILE_IO;
+
+    return status;
+}
+
+//! @brief Buffered reader of the section [pos, end) of the stream. Several
+//! readers can read different sections of one stream in turns, because
+//! every refill seeks to the position of the reader.
+struct ChunkReader
+{
+    FILE *stream    = NULL;
+    off_t pos       = 0;
+    off_t end       = 0;
+
+    byte *buf       = NULL;
+    size_t cap      = 0;
+    size_t size     = 0;
+    size_t ind      = 0;
+};
+
+inline TreeStatus reader_fill( ChunkReader *reader )
+{
+    size_t to_read = reader->cap;
+    if ( (off_t) to_read > reader->end - reader->pos )
+        to_read = (size_t) (reader->end - reader->pos);
+
+    if ( to_read == 0 )
+        return TREE_STATUS_ERROR_BAD_FILE_FORMAT;
+
+    if ( fseeko( reader->stream, reader->pos, SEEK_SET ) != 0 )
+        return TREE_STATUS_ERROR_FILE_IO;
+
+    if ( fread( reader->buf, 1, to_read, reader->stream ) != to_read )
+        return ferror( reader->stream ) ? TREE_STATUS_ERROR_FILE_IO : TREE_STATUS_ERROR_BAD_FILE_FORMAT;
+
+    reader->pos  += (off_t) to_read;
+    reader->size = to_read;
+    reader->ind  = 0;
+
+    return TREE_STATUS_OK;
+}
+
+inline TreeStatus reader_read( ChunkReader *reader, void *dest, size_t count )
+{
+    byte *dest_bytes = (byte *) dest;
+
+    while ( count )
+    {
+        if ( reader->ind == reader->size )
+            WRP_RET( reader_fill( reader ) );
+
+        size_t chunk = reader->size - reader->ind;
+        if ( chunk > count )
+            chunk = count;
+
+        memcpy( dest_bytes, reader->buf + reader->ind, chunk );
+        reader->ind += chunk;
+        dest_bytes  += chunk;
+        count       -= chunk;
+    }
+
+    return TREE_STATUS_OK;
+}
+
+inline TreeStatus load_header( FILE *stream, TreeFileHeader *header_ptr )
+{
+    if ( fread( header_ptr, sizeof(TreeFileHeader), 1, stream ) != 1 )
+        return ferror( stream ) ? TREE_STATUS_ERROR_FILE_IO : TREE_STATUS_ERROR_BAD_FILE_FORMAT;
+
+    if ( memcmp( header_ptr->magic, TREE_FILE_MAGIC, sizeof(TREE_FILE_MAGIC) ) != 0
+      || header_ptr->version != TREE_FILE_VERSION
+      || header_ptr->header_size != sizeof(TreeFileHeader) )
+        return TREE_STATUS_ERROR_BAD_FILE_FORMAT;
+
+    if ( header_ptr->nodes_count != 0 && header_ptr->depth >= header_ptr->nodes_count )
+        return TREE_STATUS_ERROR_BAD_FILE_FORMAT;
+
+    return TREE_STATUS_OK;
+}
+
+//! @brief Builds the tree in preorder, taking shapes of nodes from 'shape' and their data
+//! from 'payload'. Nodes, waiting for their right child, are kept in 'pending' stack.
+inline TreeStatus load_nodes(   Tree *tree_ptr,
+                                size_t nodes_count,
+                                ChunkReader *shape,
+                                ChunkReader *payload,
+                                TreeNode **pending,
+                                size_t pending_cap )
+{
+    size_t pending_size = 0;
+
+    TreeNode *parent = NULL;
+    bool as_left = true;
+
+    byte acc = 0;
+    for ( size_t ind = 0; ind < nodes_count; ind++ )
+    {
+        if ( ind % SHAPES_PER_BYTE == 0 )
+            WRP_RET( reader_read( shape, &acc, 1 ) );
+
+        unsigned node_shape = ( (unsigned) acc >> ( (ind % SHAPES_PER_BYTE) * SHAPE_BITS ) ) & 3u;
+
+        TreeNode *node = op_new_empty_TreeNode( tree_ptr, parent );
+        if (!node)
+            return TREE_STATUS_ERROR_MEM_ALLOC;
+
+        if (!parent)
+            tree_ptr->root = node;
+        else if (as_left)
+            tree_node_set_left( parent, node );
+        else
+            tree_node_set_right( parent, node );
+
+        WRP_RET( reader_read( payload, tree_node_data(node), tree_ptr->data_size ) );
+
+        if ( node_shape & SHAPE_HAS_RIGHT )
+        {
+            if ( pending_size == pending_cap )
+                return TREE_STATUS_ERROR_BAD_FILE_FORMAT;
+
+            pending[pending_size++] = node;
+        }
+
+        if ( node_shape & SHAPE_HAS_LEFT )
+        {
+            parent  = node;
+            as_left = true;
+        }
+        else if ( pending_size )
+        {
+            parent  = pending[--pending_size];
+            as_left = false;
+        }
+        else if ( ind + 1 != nodes_count )
+        {
+            return TREE_STATUS_ERROR_BAD_FILE_FORMAT;
+        }
+    }
+
+    // last node must have no children, and no nodes must wait for their right child
+    if ( nodes_count && ( pending_size || (parent && as_left && tree_node_left(parent) == NULL) ) )
+        return TREE_STATUS_ERROR_BAD_FILE_FORMAT;
+
+    return TREE_STATUS_OK;
+}
+
+TreeStatus tree_load( Tree *tree_ptr, FILE *stream )
+{
+    TREE_SELFCHECK(tree_ptr);
+    assert(stream);
+
+    if ( tree_ptr->root )
+        return TREE_STATUS_WARNING_ROOT_ALREADY_EXISTS;
+
+    TreeFileHeader header = {};
+    WRP_RET( load_header( stream, &header ) );
+
+    if ( header.data_size != tree_ptr->data_size )
+        return TREE_STATUS_ERROR_DATA_SIZE_MISMATCH;
+
+    if ( header.nodes_count == 0 )
+        return TREE_STATUS_OK;
+
+    size_t nodes_count  = header.nodes_count;
+    size_t shape_size   = shape_size_in_bytes( nodes_count );
+    if ( tree_ptr->data_size && nodes_count > (size_t) INT64_MAX / tree_ptr->data_size )
+        return TREE_STATUS_ERROR_BAD_FILE_FORMAT;
+
+    off_t shape_start = ftello( stream );
+    if ( shape_start < 0 )
+        return TREE_STATUS_ERROR_FILE_IO;
+
+    ChunkReader shape = {};
+    shape.stream    = stream;
+    shape.pos       = shape_start;
+    shape.end       = shape_start + (off_t) shape_size;
+    shape.cap       = TREE_IO_SHAPE_BUF_SIZE;
+
+    ChunkReader payload = {};
+    payload.stream  = stream;
+    payload.pos     = shape.end;
+    payload.end     = shape.end + (off_t) (nodes_count * tree_ptr->data_size);
+    payload.cap     = TREE_IO_PAYLOAD_BUF_SIZE;
+
+    // at most one node of each level waits for its right child
+    size_t pending_cap = header.depth + 1;
+
+    shape.buf       = (byte *) calloc( shape.cap + payload.cap, 1 );
+    TreeNode **pending = (TreeNode **) calloc( pending_cap, sizeof(TreeNode *) );
+    if ( !shape.buf || !pending )
+    {
+        free( shape.buf );
+        free( pending );
+        return TREE_STATUS_ERROR_MEM_ALLOC;
+    }
+    payload.buf     = shape.buf + shape.cap;
+
+    TreeStatus status = load_nodes( tree_ptr, nodes_count, &shape, &payload, pending, pending_cap );
+
+    free( shape.buf );
+    free( pending );
+
+    if ( status == TREE_STATUS_OK )
+    {
+        // leaving the stream right after the saved tree
+        if ( fseeko( stream, payload.end, SEEK_SET ) != 0 )
+            status = TREE_STATUS_ERROR_FILE_IO;
+    }
+
+    if ( status != TREE_STATUS_OK && tree_ptr->root )
+    {
+        // only loaded nodes are deleted (the tree may have loose nodes), and
+        // their data may be not loaded, so it mustn't be destructed
+        void (*data_dtor_func_ptr)(void *data_ptr) = tree_ptr->data_dtor_func_ptr;
+        tree_ptr->data_dtor_func_ptr = NULL;
+        tree_delete_subtree( tree_ptr, tree_ptr->root );
+        tree_ptr->data_dtor_func_ptr = data_dtor_func_ptr;
+    }
+
+    return status;
+}
+
+#ifdef TREE_COMPACT_NODES
+static_assert( sizeof(TreeImageHeader) % TREE_DATA_ALIGN == 0, "blocks of the image must be aligned" );
+
+inline size_t image_block_size( size_t data_size )
+{
+    size_t block_size = sizeof(TreeNode) + data_size;
+
+    return block_size + ( TREE_DATA_ALIGN - block_size % TREE_DATA_ALIGN ) % TREE_DATA_ALIGN;
+}
+
+//! @brief Fills blocks of the image, walking the tree in preorder. Blocks of the
+//! nodes of the current path are kept in 'path_blocks', indexed by level.
+inline void image_fill_blocks( const Tree *tree_ptr, byte *blocks, size_t block_size, TreeNode **path_blocks )
+{
+    byte *block = blocks;
+
+    TreeNode *root = tree_ptr->root;
+    for ( TreeNode *curr = root; curr; curr = tree_preorder_next( curr, root ) )
+    {
+        // file is zero-filled, so all links are already NULL
+        TreeNode *img = (TreeNode *) (void *) block;
+
+        size_t level = tree_node_level(curr);
+        tree_node_set_level( img, level );
+        path_blocks[level] = img;
+
+        if ( level )
+        {
+            TreeNode *parent_img = path_blocks[level - 1];
+            tree_node_set_parent( img, parent_img );
+
+            if ( tree_node_left( tree_node_parent(curr) ) == curr )
+                tree_node_set_left( parent_img, img );
+            else
+                tree_node_set_right( parent_img, img );
+        }
+
+        memcpy( tree_node_data(img), tree_node_data(curr), tree_ptr->data_size );
+
+        block += block_size;
+    }
+}
+
+TreeStatus tree_image_write( const Tree *tree_ptr, const char *path )
+{
+    TREE_SELFCHECK(tree_ptr);
+    assert(path);
+
+    // loose nodes aren't written, so only nodes of the root subtree are counted
+    size_t depth        = 0;
+    size_t nodes_count  = tree_subtree_size( tree_ptr->root, &depth );
+    size_t block_size   = image_block_size( tree_ptr->data_size );
+    size_t map_size     = sizeof(TreeImageHeader) + nodes_count * block_size;
+
+    TreeNode **path_blocks = (TreeNode **) calloc( depth + 1, sizeof(TreeNode *) );
+    if (!path_blocks)
+        return TREE_STATUS_ERROR_MEM_ALLOC;
+
+    int fd = open( path, O_RDWR | O_CREAT | O_TRUNC, 0644 );
+    if ( fd < 0 )
+    {
+        free( path_blocks );
+        return TREE_STATUS_ERROR_FILE_IO;
+    }
+
+    void *map = MAP_FAILED;
+    if ( ftruncate( fd, (off_t) map_size ) == 0 )
+        map = mmap( NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    close( fd );
+
+    if ( map == MAP_FAILED )
+    {
+        free( path_blocks );
+        return TREE_STATUS_ERROR_FILE_IO;
+    }
+
+    TreeImageHeader header = {};
+    memcpy( header.magic, TREE_IMAGE_MAGIC, sizeof(TREE_IMAGE_MAGIC) );
+    header.version      = TREE_IMAGE_VERSION;
+    header.header_size  = sizeof(TreeImageHeader);
+    header.node_size    = sizeof(TreeNode);
+    header.block_size   = block_size;
+    header.data_size    = tree_ptr->data_size;
+    header.nodes_count  = nodes_count;
+    header.depth        = depth;
+    memcpy( map, &header, sizeof(header) );
+
+    image_fill_blocks( tree_ptr, (byte *) map + sizeof(TreeImageHeader), block_size, path_blocks );
+
+    free( path_blocks );
+
+    if ( munmap( map, map_size ) != 0 )
+        return TREE_STATUS_ERROR_FILE_IO;
+
+    return TREE_STATUS_OK;
+}
+
+TreeStatus tree_image_open( TreeImage *image_ptr, const char *path )
+{
+    assert(image_ptr);
+    assert(path);
+
+    int fd = open( path, O_RDONLY );
+    if ( fd < 0 )
+        return TREE_STATUS_ERROR_FILE_IO;
+
+    struct stat st = {};
+    if ( fstat( fd, &st ) != 0 )
+    {
+        close( fd );
+        return TREE_STATUS_ERROR_FILE_IO;
+    }
+
+    size_t map_size = (size_t) st.st_size;
+    if ( map_size < sizeof(TreeImageHeader) )
+    {
+        close( fd );
+        return TREE_STATUS_ERROR_BAD_FILE_FORMAT;
+    }
+
+    void *map = mmap( NULL, map_size, PROT_READ, MAP_SHARED, fd, 0 );
+    close( fd );
+    if ( map == MAP_FAILED )
+        return TREE_STATUS_ERROR_FILE_IO;
+
+    const TreeImageHeader *header = (const TreeImageHeader *) map;
+    if ( memcmp( header->magic, TREE_IMAGE_MAGIC, sizeof(TREE_IMAGE_MAGIC) ) != 0
+      || header->version        != TREE_IMAGE_VERSION
+      || header->header_size    != sizeof(TreeImageHeader)
+      || header->node_size      != sizeof(TreeNode)
+      || header->block_size     != image_block_size( header->data_size )
+      || header->nodes_count    > ( map_size - sizeof(TreeImageHeader) ) / header->block_size
+      || header->nodes_count * header->block_size != map_size - sizeof(TreeImageHeader)
+      || ( header->nodes_count != 0 && header->depth >= header->nodes_count ) )
+    {
+        munmap( map, map_size );
+        return TREE_STATUS_ERROR_BAD_FILE_FORMAT;
+    }
+
+    *image_ptr = {};
+    image_ptr->map      = map;
+    image_ptr->map_size = map_size;
+
+    Tree *tree_ptr = &image_ptr->tree;
+    tree_ptr->data_size     = header->data_size;
+    tree_ptr->nodes_count   = header->nodes_count;
+    tree_ptr->depth         = header->depth;
+    if ( header->nodes_count )
+        tree_ptr->root = (TreeNode *) (void *) ( (byte *) map + sizeof(TreeImageHeader) );
+
+    return TREE_STATUS_OK;
+}
+
+TreeStatus tree_image_close( TreeImage *image_ptr )
+{
+    assert(image_ptr);
+
+    if ( image_ptr->map && munmap( image_ptr->map, image_ptr->map_size ) != 0 )
+        return TREE_STATUS_ERROR_FILE_IO;
+
+    *image_ptr = {};
+
+    return TREE_STATUS_OK;
+}
+#endif /* TREE_COMPACT_NODES */
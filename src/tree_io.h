@@ -0,0 +1,100 @@
+#ifndef TREE_IO_H
+#define TREE_IO_H
+
+#include "tree_common.h"
+
+/*
+    Binary format of a saved tree (all numbers are in the byte order of the machine):
+    1) TreeFileHeader;
+    2) shape - 2 bits per node in preorder (bit 0 - node has left child,
+       bit 1 - node has right child), 4 nodes per byte, the last byte is padded with zeroes;
+    3) payload - data of all nodes in preorder, 'data_size' bytes each, without gaps.
+*/
+
+const char      TREE_FILE_MAGIC[8]  = { 'F', 'T', 'R', 'E', 'E', 'B', 'I', 'N' };
+const uint32_t  TREE_FILE_VERSION   = 1;
+
+struct TreeFileHeader
+{
+    char magic[8]           = {};
+    uint32_t version        = 0;
+    uint32_t header_size    = 0;    //< sizeof(TreeFileHeader), also catches byte order mismatch
+    uint64_t data_size      = 0;
+    uint64_t nodes_count    = 0;
+    uint64_t depth          = 0;
+};
+
+//! @brief Writes the tree into the stream in the binary format (see above).
+//! Tree is walked three times (to count nodes, for shape and for payload), and written
+//! through a small fixed-size buffer, so no memory, proportional to the tree size, is used.
+//! @note Data is written byte by byte, so it mustn't contain pointers.
+//! @note Only nodes, reachable from the root, are saved (loose nodes are not).
+TreeStatus tree_save( const Tree *tree_ptr, FILE *stream );
+
+//! @brief Reads tree, written by tree_save(), from the stream into EMPTY constructed
+//! tree 'tree_ptr' (data_dtor and other parameters of the tree are not saved in the file,
+//! so they are taken from 'tree_ptr'). Nodes are allocated in preorder straight from
+//! the allocator of the tree, and data is copied into them from the read buffer.
+//! @note 'stream' must be seekable (shape and payload are read in turns by chunks,
+//! so they never need to fit in memory).
+//! @note If error happens, the nodes, loaded so far, are deleted (data_dtor is not
+//! called for them), so the tree is left as it was (loose nodes of it are kept).
+//! @return TREE_STATUS_WARNING_ROOT_ALREADY_EXISTS if the tree is not empty,
+//! TREE_STATUS_ERROR_DATA_SIZE_MISMATCH if data size in the file differs from the
+//! one of the tree, TREE_STATUS_ERROR_BAD_FILE_FORMAT if the file is broken or has
+//! other version.
+TreeStatus tree_load( Tree *tree_ptr, FILE *stream );
+
+#ifdef TREE_COMPACT_NODES
+/*
+    Tree image is a file, which can be mapped into memory and walked right away.
+    It is TreeImageHeader, followed by blocks of all nodes in preorder, laid out
+    exactly as in memory: TreeNode (with self-relative links, see tree_common.h),
+    then data, padded up to TREE_DATA_ALIGN. So read functions of tree.h
+    (tree_get_root, tree_get_left_child, tree_get_data_ptr and so on) work
+    right on the mapped file, and pages are loaded lazily and shared between
+    all processes, mapping the same file.
+    Images are possible only in TREE_COMPACT_NODES mode, because TreeNode with
+    pointers would need relocation.
+*/
+
+const char      TREE_IMAGE_MAGIC[8]     = { 'F', 'T', 'R', 'E', 'E', 'I', 'M', 'G' };
+const uint32_t  TREE_IMAGE_VERSION      = 1;
+
+struct TreeImageHeader
+{
+    char magic[8]           = {};
+    uint32_t version        = 0;
+    uint32_t header_size    = 0;    //< sizeof(TreeImageHeader), blocks start right after it
+    uint64_t node_size      = 0;    //< sizeof(TreeNode), must be the same in the reading build
+    uint64_t block_size     = 0;
+    uint64_t data_size      = 0;
+    uint64_t nodes_count    = 0;
+    uint64_t depth          = 0;
+    uint64_t reserved       = 0;
+};
+
+//! @brief Read-only tree, mapped from the image file.
+//! @attention 'tree' mustn't be given to functions, changing the tree (including tree_dtor()).
+struct TreeImage
+{
+    Tree tree       = {};
+    void *map       = NULL;
+    size_t map_size = 0;
+};
+
+//! @brief Writes image of the tree into the file 'path' (the file is created or truncated).
+//! @note Only nodes, reachable from the root, are written (loose nodes are not).
+TreeStatus tree_image_write( const Tree *tree_ptr, const char *path );
+
+//! @brief Maps image file 'path' read-only. Nothing is read from the file
+//! except for the header, until nodes are accessed.
+//! @note Image must be written by the build with the same TreeNode layout,
+//! otherwise TREE_STATUS_ERROR_BAD_FILE_FORMAT is returned.
+//! Links inside the image are not checked.
+TreeStatus tree_image_open( TreeImage *image_ptr, const char *path );
+
+TreeStatus tree_image_close( TreeImage *image_ptr );
+#endif /* TREE_COMPACT_NODES */
+
+#endif /* TREE_IO_H */
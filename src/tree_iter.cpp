@@ -0,0 +1,125 @@
+#include "tree_iter.h"
+
+#include <stdlib.h>
+#include <assert.h>
+
+
+const size_t TREE_ITER_MIN_QUEUE_CAP = 16;
+
+inline TreeStatus queue_push( TreeIter *iter_ptr, TreeNode *node_ptr )
+{
+    if ( iter_ptr->queue_size == iter_ptr->queue_cap )
+    {
+        size_t new_cap = iter_ptr->queue_cap ? 2 * iter_ptr->queue_cap : TREE_ITER_MIN_QUEUE_CAP;
+
+        TreeNode **new_queue = (TreeNode **) calloc( new_cap, sizeof(TreeNode *) );
+        if (!new_queue)
+            return TREE_STATUS_ERROR_MEM_ALLOC;
+
+        // unrolling the ring buffer, so that head becomes 0
+        for (size_t ind = 0; ind < iter_ptr->queue_size; ind++)
+            new_queue[ind] = iter_ptr->queue[ (iter_ptr->queue_head + ind) % iter_ptr->queue_cap ];
+
+        free( iter_ptr->queue );
+        iter_ptr->queue         = new_queue;
+        iter_ptr->queue_cap     = new_cap;
+        iter_ptr->queue_head    = 0;
+    }
+
+    iter_ptr->queue[ (iter_ptr->queue_head + iter_ptr->queue_size) % iter_ptr->queue_cap ] = node_ptr;
+    iter_ptr->queue_size++;
+
+    return TREE_STATUS_OK;
+}
+
+inline TreeNode *queue_pop( TreeIter *iter_ptr )
+{
+    if ( iter_ptr->queue_size == 0 )
+        return NULL;
+
+    TreeNode *node_ptr = iter_ptr->queue[iter_ptr->queue_head];
+    iter_ptr->queue_head = (iter_ptr->queue_head + 1) % iter_ptr->queue_cap;
+    iter_ptr->queue_size--;
+
+    return node_ptr;
+}
+
+//! @brief Finds the node, following 'node_ptr' in the order of the iterator.
+inline TreeNode *iter_step( TreeIter *iter_ptr, TreeNode *node_ptr )
+{
+    switch (iter_ptr->order)
+    {
+    case TREE_ITER_PREORDER:
+        return tree_preorder_next( node_ptr, iter_ptr->subtree_root );
+    case TREE_ITER_INORDER:
+        return tree_inorder_next( node_ptr, iter_ptr->subtree_root );
+    case TREE_ITER_POSTORDER:
+        return tree_postorder_next( node_ptr, iter_ptr->subtree_root );
+    case TREE_ITER_LEVEL_ORDER:
+    {
+        TreeNode *left  = tree_node_left( node_ptr );
+        TreeNode *right = tree_node_right( node_ptr );
+
+        if ( ( left && (iter_ptr->status = queue_push( iter_ptr, left )) != TREE_STATUS_OK )
+          || ( right && (iter_ptr->status = queue_push( iter_ptr, right )) != TREE_STATUS_OK ) )
+            return NULL;
+
+        return queue_pop( iter_ptr );
+    }
+    default:
+        assert(0 && "Unknown TreeIterOrder!");
+        return NULL;
+    }
+}
+
+TreeStatus tree_iter_ctor( TreeIter *iter_ptr, TreeNode *subtree_root, TreeIterOrder order )
+{
+    assert(iter_ptr);
+
+    *iter_ptr = {};
+    iter_ptr->order         = order;
+    iter_ptr->subtree_root  = subtree_root;
+
+    if ( !subtree_root )
+        return TREE_STATUS_OK;
+
+    switch (order)
+    {
+    case TREE_ITER_PREORDER:
+    case TREE_ITER_LEVEL_ORDER:
+        iter_ptr->next = subtree_root;
+        break;
+    case TREE_ITER_INORDER:
+        iter_ptr->next = tree_inorder_first( subtree_root );
+        break;
+    case TREE_ITER_POSTORDER:
+        iter_ptr->next = tree_postorder_first( subtree_root );
+        break;
+    default:
+        assert(0 && "Unknown TreeIterOrder!");
+        break;
+    }
+
+    return TREE_STATUS_OK;
+}
+
+TreeNode *tree_iter_next( TreeIter *iter_ptr )
+{
+    assert(iter_ptr);
+
+    TreeNode *curr = iter_ptr->next;
+    if ( curr )
+        iter_ptr->next = iter_step( iter_ptr, curr );
+
+    return curr;
+}
+
+TreeStatus tree_iter_dtor( TreeIter *iter_ptr )
+{
+    assert(iter_ptr);
+
+    free( iter_ptr->queue );
+    *iter_ptr = {};
+
+    return TREE_STATUS_OK;
+}
@@ -0,0 +1,188 @@
+#ifndef TREE_ITER_H
+#define TREE_ITER_H
+
+#include "tree_common.h"
+
+/*
+    Non-recursive traversals of subtrees. Preorder, inorder and postorder ones
+    need no memory at all (they use parent links), so any depth can be handled.
+    Every '*_next' function walks only inside the subtree, starting with 'subtree_root',
+    and returns NULL after the last node of it.
+*/
+
+//! @brief Returns the node, going right after the whole subtree of 'node_ptr' in preorder
+//! (so that descendants of 'node_ptr' are skipped).
+inline TreeNode *tree_preorder_skip( const TreeNode *node_ptr, const TreeNode *subtree_root )
+{
+    assert(node_ptr);
+    assert(subtree_root);
+
+    while ( node_ptr != subtree_root )
+    {
+        TreeNode *parent = tree_node_parent(node_ptr);
+        TreeNode *right  = tree_node_right(parent);
+
+        if ( right && right != node_ptr )
+            return right;
+
+        node_ptr = parent;
+    }
+
+    return NULL;
+}
+
+//! @brief Returns the node, going right after 'node_ptr' in preorder.
+inline TreeNode *tree_preorder_next( const TreeNode *node_ptr, const TreeNode *subtree_root )
+{
+    assert(node_ptr);
+    assert(subtree_root);
+
+    TreeNode *child = tree_node_left(node_ptr);
+    if ( child )
+        return child;
+
+    child = tree_node_right(node_ptr);
+    if ( child )
+        return child;
+
+    return tree_preorder_skip( node_ptr, subtree_root );
+}
+
+//! @brief Returns the first node of the subtree in inorder (the leftmost one).
+inline TreeNode *tree_inorder_first( TreeNode *subtree_root )
+{
+    assert(subtree_root);
+
+    TreeNode *curr = subtree_root;
+    while ( tree_node_left(curr) )
+        curr = tree_node_left(curr);
+
+    return curr;
+}
+
+//! @brief Returns the node, going right after 'node_ptr' in inorder.
+inline TreeNode *tree_inorder_next( const TreeNode *node_ptr, const TreeNode *subtree_root )
+{
+    assert(node_ptr);
+    assert(subtree_root);
+
+    TreeNode *right = tree_node_right(node_ptr);
+    if ( right )
+        return tree_inorder_first( right );
+
+    while ( node_ptr != subtree_root )
+    {
+        TreeNode *parent = tree_node_parent(node_ptr);
+
+        if ( tree_node_left(parent) == node_ptr )
+            return parent;
+
+        node_ptr = parent;
+    }
+
+    return NULL;
+}
+
+//! @brief Returns number of nodes of the subtree (0 if 'subtree_root' is NULL).
+//! If 'depth_ptr' is not NULL, max distance from 'subtree_root' to its nodes is written by it.
+//! @note Loose nodes of the tree aren't in any subtree, so for the root both may be
+//! less than nodes_count and depth of the tree.
+inline size_t tree_subtree_size( const TreeNode *subtree_root, size_t *depth_ptr = NULL )
+{
+    size_t count     = 0;
+    size_t max_level = 0;
+    for ( const TreeNode *curr = subtree_root; curr; curr = tree_preorder_next( curr, subtree_root ) )
+    {
+        count++;
+        if ( tree_node_level(curr) > max_level )
+            max_level = tree_node_level(curr);
+    }
+
+    if ( depth_ptr )
+        *depth_ptr = ( subtree_root ? max_level - tree_node_level(subtree_root) : 0 );
+
+    return count;
+}
+
+//! @brief Returns the first node of the subtree in postorder (the first leaf, met
+//! by always going left if possible, and right otherwise).
+inline TreeNode *tree_postorder_first( TreeNode *subtree_root )
+{
+    assert(subtree_root);
+
+    TreeNode *curr = subtree_root;
+    while ( true )
+    {
+        if ( tree_node_left(curr) )
+            curr = tree_node_left(curr);
+        else if ( tree_node_right(curr) )
+            curr = tree_node_right(curr);
+        else
+            return curr;
+    }
+}
+
+//! @brief Returns the node, going right after 'node_ptr' in postorder.
+//! @note Only the parent of 'node_ptr' and nodes of its right subtree are read,
+//! so 'node_ptr' (and its subtree) may be deleted right after this call.
+inline TreeNode *tree_postorder_next( const TreeNode *node_ptr, const TreeNode *subtree_root )
+{
+    assert(node_ptr);
+    assert(subtree_root);
+
+    if ( node_ptr == subtree_root )
+        return NULL;
+
+    TreeNode *parent = tree_node_parent(node_ptr);
+    TreeNode *right  = tree_node_right(parent);
+
+    if ( right && right != node_ptr )
+        return tree_postorder_first( right );
+
+    return parent;
+}
+
+
+enum TreeIterOrder
+{
+    TREE_ITER_PREORDER,
+    TREE_ITER_INORDER,
+    TREE_ITER_POSTORDER,
+    TREE_ITER_LEVEL_ORDER,  //< Breadth-first, uses a queue.
+};
+
+//! @brief Iterator over all nodes of a subtree in given order.
+//! @details Usage:
+//! TreeIter iter = {};
+//! tree_iter_ctor( &iter, subtree_root, TREE_ITER_POSTORDER );
+//! for ( TreeNode *node = tree_iter_next( &iter ); node; node = tree_iter_next( &iter ) ) { ... }
+//! tree_iter_dtor( &iter );
+//! @note Next node is always found before the current one is returned, so in
+//! TREE_ITER_POSTORDER the returned node may be deleted before the next call.
+struct TreeIter
+{
+    TreeIterOrder order     = TREE_ITER_PREORDER;
+    TreeNode *subtree_root  = NULL;
+    TreeNode *next          = NULL;
+
+    // ring buffer of nodes, used only by TREE_ITER_LEVEL_ORDER
+    TreeNode **queue    = NULL;
+    size_t queue_cap    = 0;
+    size_t queue_head   = 0;
+    size_t queue_size   = 0;
+
+    //! @brief Becomes TREE_STATUS_ERROR_MEM_ALLOC if the queue
+    //! can't grow; the iteration is stopped in such case.
+    TreeStatus status   = TREE_STATUS_OK;
+};
+
+//! @param [in] subtree_root Root of the subtree to iterate over, may be NULL.
+TreeStatus tree_iter_ctor( TreeIter *iter_ptr, TreeNode *subtree_root, TreeIterOrder order );
+
+//! @brief Returns the next node of the subtree, or NULL if all nodes are already returned
+//! (or some error happened, see TreeIter::status).
+TreeNode *tree_iter_next( TreeIter *iter_ptr );
+
+TreeStatus tree_iter_dtor( TreeIter *iter_ptr );
+
+#endif /* TREE_ITER_H */
@@ -0,0 +1,220 @@
+#include "tree.h"
+#include "tree_alloc.h"
+
+#include <assert.h>
+#include <memory.h>
+#include <stdlib.h>
+
+
+//! @brief Returns 1 if all live blocks of the allocator of the tree are nodes,
+//! reachable from the root, 0 otherwise. Number of these nodes is written by 'count_ptr'.
+inline int all_nodes_reachable( Tree *tree_ptr, size_t *count_ptr )
+{
+    size_t count = 0;
+    for ( TreeNode *curr = tree_ptr->root; curr; curr = tree_preorder_next( curr, tree_ptr->root ) )
+        count++;
+
+    *count_ptr = count;
+
+    TreeAllocStats stats = {};
+    if ( _tree_alloc_get_stats( tree_ptr->alloc, &stats ) != TREE_ALLOC_OK )
+        return 0;
+
+    return stats.live_blocks == count;
+}
+
+//! @brief Moves the node into a new block of the allocator of the tree, fixing links
+//! of its parent (or the root of the tree) and of its children, and frees the old block.
+//! @return The node at the new place.
+//! @note New block must be available without allocating memory (see _tree_alloc_compact_begin()).
+inline TreeNode *move_node( Tree *tree_ptr, TreeNode *node_ptr )
+{
+    char *new_mem = (char *) _tree_alloc_new( tree_ptr->alloc );
+    assert(new_mem);
+
+    TreeNode *new_node = (TreeNode *) new_mem;
+#ifndef TREE_COMPACT_NODES
+    new_node->data_ptr = (void*) (new_mem + sizeof(TreeNode));
+#endif
+    memcpy( tree_node_data(new_node), tree_node_data(node_ptr), tree_ptr->data_size );
+    tree_node_set_level( new_node, tree_node_level(node_ptr) );
+
+    // links are set through accessors, because compact links depend on the place of the node
+    TreeNode *left   = tree_node_left(node_ptr);
+    TreeNode *right  = tree_node_right(node_ptr);
+    TreeNode *parent = tree_node_parent(node_ptr);
+
+    tree_node_set_left( new_node, left );
+    tree_node_set_right( new_node, right );
+    tree_node_set_parent( new_node, parent );
+
+    if (left)
+        tree_node_set_parent( left, new_node );
+    if (right)
+        tree_node_set_parent( right, new_node );
+
+    if ( !parent )
+        tree_ptr->root = new_node;
+    else if ( tree_node_left(parent) == node_ptr )
+        tree_node_set_left( parent, new_node );
+    else
+        tree_node_set_right( parent, new_node );
+
+    if ( tree_ptr->persistent )
+        *_tree_alloc_ref( tree_ptr->alloc, new_node ) = *_tree_alloc_ref( tree_ptr->alloc, node_ptr );
+    if ( tree_ptr->hash_cache )
+        *_tree_alloc_hash( tree_ptr->alloc, new_node ) = *_tree_alloc_hash( tree_ptr->alloc, node_ptr );
+
+    _tree_alloc_del( tree_ptr->alloc, node_ptr );
+
+    return new_node;
+}
+
+//! @brief Checks, that nodes of the tree can be moved (see tree_layout.h),
+//! and writes number of its nodes by 'count_ptr'.
+inline TreeStatus check_movable( Tree *tree_ptr, size_t *count_ptr )
+{
+    if ( tree_ptr->snapshots_count )
+        return TREE_STATUS_WARNING_NODE_IS_SHARED;
+
+    if ( !all_nodes_reachable( tree_ptr, count_ptr ) )
+        return TREE_STATUS_WARNING_TREE_HAS_UNREACHABLE_NODES;
+
+    return TREE_STATUS_OK;
+}
+
+TreeStatus tree_compact( Tree *tree_ptr )
+{
+    TREE_SELFCHECK(tree_ptr);
+    assert(tree_ptr->alloc);
+    TREE_TRACE(tree_ptr, COMPACT);
+
+    size_t count = 0;
+    WRP_RET( check_movable( tree_ptr, &count ) );
+
+    if ( _tree_alloc_compact_begin( tree_ptr->alloc, count ) != TREE_ALLOC_OK )
+        return TREE_STATUS_ERROR_MEM_ALLOC;
+
+    // nodes are moved in preorder, so that moved ones are placed close to each other
+    size_t moved = 0;
+    for ( TreeNode *curr = tree_ptr->root; curr; curr = tree_preorder_next( curr, tree_ptr->root ) )
+    {
+        if ( _tree_alloc_is_evacuated( tree_ptr->alloc, curr ) )
+        {
+            curr = move_node( tree_ptr, curr );
+            moved++;
+        }
+    }
+    TREE_TRACE_TOUCH( moved );
+
+    if ( _tree_alloc_compact_end( tree_ptr->alloc ) != TREE_ALLOC_OK )
+        return TREE_STATUS_ERROR_ALLOC_INIT;
+
+    return TREE_STATUS_OK;
+}
+
+//! @brief Moves nodes of the subtree, which are less than 'height' levels below
+//! 'subtree_root', in van Emde Boas order: the top half of levels first (recursively),
+//! then every subtree, hanging from it, one after another (recursively too).
+//! @return The root of the subtree at its new place.
+//! @note Depth of recursion is about log2(height).
+static TreeNode *move_van_emde_boas( Tree *tree_ptr, TreeNode *subtree_root, size_t height )
+{
+    assert(height > 0);
+
+    if ( height == 1 )
+        return move_node( tree_ptr, subtree_root );
+
+    size_t top_height = height / 2;
+    subtree_root = move_van_emde_boas( tree_ptr, subtree_root, top_height );
+
+    // roots of bottom subtrees are children of the last level of the top one
+    size_t last_top_level = tree_node_level(subtree_root) + top_height - 1;
+    for ( TreeNode *curr = subtree_root; curr; )
+    {
+        if ( tree_node_level(curr) < last_top_level )
+        {
+            curr = tree_preorder_next( curr, subtree_root );
+            continue;
+        }
+
+        if ( tree_node_left(curr) )
+            move_van_emde_boas( tree_ptr, tree_node_left(curr), height - top_height );
+        if ( tree_node_right(curr) )
+            move_van_emde_boas( tree_ptr, tree_node_right(curr), height - top_height );
+
+        curr = tree_preorder_skip( curr, subtree_root );
+    }
+
+    return subtree_root;
+}
+
+//! @brief Moves all nodes in level order (breadth-first), using 'queue' of nodes_count nodes.
+//! @note Nodes in the queue are not moved yet, so pointers to them stay valid.
+inline void move_level_order( Tree *tree_ptr, TreeNode **queue )
+{
+    size_t head = 0;
+    size_t tail = 0;
+
+    queue[tail++] = tree_ptr->root;
+    while ( head < tail )
+    {
+        TreeNode *curr = move_node( tree_ptr, queue[head++] );
+
+        if ( tree_node_left(curr) )
+            queue[tail++] = tree_node_left(curr);
+        if ( tree_node_right(curr) )
+            queue[tail++] = tree_node_right(curr);
+    }
+}
+
+TreeStatus tree_relayout( Tree *tree_ptr, TreeLayoutOrder order )
+{
+    TREE_SELFCHECK(tree_ptr);
+    assert(tree_ptr->alloc);
+    TREE_TRACE(tree_ptr, RELAYOUT);
+
+    size_t count = 0;
+    WRP_RET( check_movable( tree_ptr, &count ) );
+
+    if ( !tree_ptr->root )
+        return TREE_STATUS_OK;
+
+    TreeNode **queue = NULL;
+    if ( order == TREE_LAYOUT_LEVEL_ORDER )
+    {
+        queue = (TreeNode **) calloc( count, sizeof(TreeNode *) );
+        if (!queue) return TREE_STATUS_ERROR_MEM_ALLOC;
+    }
+
+    if ( _tree_alloc_relayout_begin( tree_ptr->alloc, count ) != TREE_ALLOC_OK )
+    {
+        free( queue );
+        return TREE_STATUS_ERROR_MEM_ALLOC;
+    }
+
+    switch (order)
+    {
+    case TREE_LAYOUT_PREORDER:
+        for ( TreeNode *curr = tree_ptr->root; curr; curr = tree_preorder_next( curr, tree_ptr->root ) )
+            curr = move_node( tree_ptr, curr );
+        break;
+    case TREE_LAYOUT_LEVEL_ORDER:
+        move_level_order( tree_ptr, queue );
+        break;
+    case TREE_LAYOUT_VAN_EMDE_BOAS:
+        move_van_emde_boas( tree_ptr, tree_ptr->root, tree_get_depth( tree_ptr ) + 1 );
+        break;
+    default:
+        assert(0 && "Unknown TreeLayoutOrder!");
+        break;
+    }
+    TREE_TRACE_TOUCH( count );
+
+    free( queue );
+
+    if ( _tree_alloc_compact_end( tree_ptr->alloc ) != TREE_ALLOC_OK )
+        return TREE_STATUS_ERROR_ALLOC_INIT;
+
+    return TREE_STATUS_OK;
+}
@@ -0,0 +1,42 @@
+#ifndef TREE_LAYOUT_H
+#define TREE_LAYOUT_H
+
+#include "tree_common.h"
+
+/*
+    Operations, which move nodes of a tree to other places in memory without changing
+    the tree itself. All pointers to nodes of the tree, kept by the user, become invalid.
+    Data of nodes is moved byte by byte, so it mustn't point into itself.
+    Only trees, all nodes of which are reachable from the root, can be changed:
+    loose nodes, nodes of snapshots (see tree_persist.h) and of DAGs (see tree_dag.h)
+    may be used through pointers, which can't be fixed.
+*/
+
+//! @brief Moves all nodes into as few memory pools as possible (the biggest ones
+//! are filled first) and gives memory of the emptied pools back to the OS, so memory
+//! of the tree is proportional to the number of its nodes, not to the max number of them.
+//! Takes time proportional to the number of nodes.
+//! @return TREE_STATUS_WARNING_NODE_IS_SHARED if the tree has snapshots,
+//! TREE_STATUS_WARNING_TREE_HAS_UNREACHABLE_NODES if there are nodes, which are not
+//! reachable from the root (nothing is changed in both cases).
+TreeStatus tree_compact( Tree *tree_ptr );
+
+
+enum TreeLayoutOrder
+{
+    TREE_LAYOUT_PREORDER,       //< Subtrees are contiguous, good for depth-first walks.
+    TREE_LAYOUT_LEVEL_ORDER,    //< Breadth-first, good for walks over the top levels.
+    TREE_LAYOUT_VAN_EMDE_BOAS,  //< Recursive halving of levels, so a root-to-leaf path of length h
+                                //< touches O(h / log2(B)) cache lines of B nodes for any B.
+};
+
+//! @brief Moves all nodes into one new memory pool, one after another in the given order,
+//! and frees the old pools, so that traversals and root-to-leaf searches read memory
+//! sequentially instead of jumping over blocks, scattered by insertions and deletions.
+//! Is meant to be called after the tree is built, before many read-only passes.
+//! Takes time proportional to the number of nodes (times log2 of the depth for
+//! TREE_LAYOUT_VAN_EMDE_BOAS), while it runs the memory for nodes is taken twice.
+//! @return The same warnings as tree_compact() (nothing is changed in these cases).
+TreeStatus tree_relayout( Tree *tree_ptr, TreeLayoutOrder order );
+
+#endif /* TREE_LAYOUT_H */
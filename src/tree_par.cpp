@@ -0,0 +1,252 @@
+#include "tree_par.h"
+
+#include <stdlib.h>
+#include <assert.h>
+
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <thread>
+
+
+const size_t TREE_PAR_MIN_DEQUE_CAP = 16;
+
+//! @brief Deque of tasks of one worker (ring buffer).
+struct alignas(64) TreeParWorker
+{
+    std::mutex mutex{};
+
+    TreeParTask *tasks  = NULL;
+    size_t cap          = 0;
+    size_t head         = 0;
+    std::atomic<size_t> size{0};    //< Is changed only under 'mutex', but can be read without it.
+};
+
+struct TreeParPool
+{
+    TreeParWorker *workers  = NULL;
+    size_t workers_count    = 0;
+
+    tree_par_run_t run      = NULL;
+    void *ctx               = NULL;
+
+    //! @brief Number of tasks, which are queued or being run.
+    std::atomic<size_t> pending{0};
+
+    std::atomic<int> cancelled{0};
+};
+
+inline int deque_push( TreeParWorker *worker, TreeParTask task )
+{
+    std::lock_guard<std::mutex> lock( worker->mutex );
+
+    size_t size = worker->size.load( std::memory_order_relaxed );
+    if ( size == worker->cap )
+    {
+        size_t new_cap = worker->cap ? 2 * worker->cap : TREE_PAR_MIN_DEQUE_CAP;
+
+        TreeParTask *new_tasks = (TreeParTask *) calloc( new_cap, sizeof(TreeParTask) );
+        if (!new_tasks)
+            return 0;
+
+        for (size_t ind = 0; ind < size; ind++)
+            new_tasks[ind] = worker->tasks[ (worker->head + ind) % worker->cap ];
+
+        free( worker->tasks );
+        worker->tasks   = new_tasks;
+        worker->cap     = new_cap;
+        worker->head    = 0;
+    }
+
+    worker->tasks[ (worker->head + size) % worker->cap ] = task;
+    worker->size.store( size + 1, std::memory_order_relaxed );
+
+    return 1;
+}
+
+//! @brief Takes the newest task from the back of the deque (is used by the owner).
+inline int deque_pop_back( TreeParWorker *worker, TreeParTask *task_ptr )
+{
+    std::lock_guard<std::mutex> lock( worker->mutex );
+
+    size_t size = worker->size.load( std::memory_order_relaxed );
+    if ( size == 0 )
+        return 0;
+
+    *task_ptr = worker->tasks[ (worker->head + size - 1) % worker->cap ];
+    worker->size.store( size - 1, std::memory_order_relaxed );
+
+    return 1;
+}
+
+//! @brief Takes the oldest task from the front of the deque (is used by thieves).
+inline int deque_pop_front( TreeParWorker *worker, TreeParTask *task_ptr )
+{
+    if ( worker->size.load( std::memory_order_relaxed ) == 0 )
+        return 0;
+
+    std::lock_guard<std::mutex> lock( worker->mutex );
+
+    size_t size = worker->size.load( std::memory_order_relaxed );
+    if ( size == 0 )
+        return 0;
+
+    *task_ptr = worker->tasks[worker->head];
+    worker->head = (worker->head + 1) % worker->cap;
+    worker->size.store( size - 1, std::memory_order_relaxed );
+
+    return 1;
+}
+
+inline int find_task( TreeParPool *pool, size_t worker_id, TreeParTask *task_ptr )
+{
+    if ( deque_pop_back( &pool->workers[worker_id], task_ptr ) )
+        return 1;
+
+    for (size_t shift = 1; shift < pool->workers_count; shift++)
+    {
+        size_t victim = (worker_id + shift) % pool->workers_count;
+        if ( deque_pop_front( &pool->workers[victim], task_ptr ) )
+            return 1;
+    }
+
+    return 0;
+}
+
+static void worker_loop( TreeParPool *pool, size_t worker_id )
+{
+    while ( pool->pending.load( std::memory_order_acquire ) != 0 )
+    {
+        TreeParTask task = {};
+        if ( !find_task( pool, worker_id, &task ) )
+        {
+            std::this_thread::yield();
+            continue;
+        }
+
+        if ( !pool->cancelled.load( std::memory_order_relaxed ) )
+            pool->run( pool, worker_id, task );
+
+        pool->pending.fetch_sub( 1, std::memory_order_acq_rel );
+    }
+}
+
+TreeStatus _tree_par_run(   size_t threads_count,
+                            tree_par_run_t run,
+                            void *ctx,
+                            const TreeParTask *tasks,
+                            size_t tasks_count )
+{
+    assert(threads_count > 0);
+    assert(run);
+    assert(tasks || tasks_count == 0);
+
+    TreeParPool pool = {};
+    pool.run            = run;
+    pool.ctx            = ctx;
+    pool.workers_count  = threads_count;
+    pool.workers        = new (std::nothrow) TreeParWorker[threads_count];
+    if (!pool.workers)
+        return TREE_STATUS_ERROR_MEM_ALLOC;
+
+    TreeStatus status = TREE_STATUS_OK;
+    for (size_t ind = 0; ind < tasks_count; ind++)
+    {
+        if ( !deque_push( &pool.workers[ind % threads_count], tasks[ind] ) )
+        {
+            status = TREE_STATUS_ERROR_MEM_ALLOC;
+            break;
+        }
+        pool.pending.fetch_add( 1, std::memory_order_relaxed );
+    }
+
+    std::thread *threads = NULL;
+    size_t started = 0;
+    if ( status == TREE_STATUS_OK && threads_count > 1 )
+    {
+        threads = new (std::nothrow) std::thread[threads_count - 1];
+        for (; threads && started < threads_count - 1; started++)
+        {
+            try
+            {
+                threads[started] = std::thread( worker_loop, &pool, started + 1 );
+            }
+            catch (...)
+            {
+                break;
+            }
+        }
+    }
+
+    // tasks of workers, which are not started, are stolen by the started ones
+    if ( status == TREE_STATUS_OK )
+        worker_loop( &pool, 0 );
+
+    for (size_t ind = 0; ind < started; ind++)
+        threads[ind].join();
+
+    delete [] threads;
+
+    for (size_t ind = 0; ind < threads_count; ind++)
+        free( pool.workers[ind].tasks );
+    delete [] pool.workers;
+
+    return status;
+}
+
+void *_tree_par_ctx( TreeParPool *pool )
+{
+    assert(pool);
+
+    return pool->ctx;
+}
+
+int _tree_par_fork( TreeParPool *pool, size_t worker_id, TreeParTask task )
+{
+    assert(pool);
+    assert(worker_id < pool->workers_count);
+
+    // counted before it can be stolen and finished
+    pool->pending.fetch_add( 1, std::memory_order_relaxed );
+
+    if ( !deque_push( &pool->workers[worker_id], task ) )
+    {
+        pool->pending.fetch_sub( 1, std::memory_order_relaxed );
+        return 0;
+    }
+
+    return 1;
+}
+
+int _tree_par_wants_fork( TreeParPool *pool, size_t worker_id )
+{
+    assert(pool);
+    assert(worker_id < pool->workers_count);
+
+    return pool->workers_count > 1
+        && pool->workers[worker_id].size.load( std::memory_order_relaxed ) == 0;
+}
+
+void _tree_par_cancel( TreeParPool *pool )
+{
+    assert(pool);
+
+    pool->cancelled.store( 1, std::memory_order_relaxed );
+}
+
+int _tree_par_is_cancelled( TreeParPool *pool )
+{
+    assert(pool);
+
+    return pool->cancelled.load( std::memory_order_relaxed );
+}
+
+size_t _tree_par_threads_count( size_t threads_count )
+{
+    if ( threads_count )
+        return threads_count;
+
+    size_t hw_threads = std::thread::hardware_concurrency();
+
+    return hw_threads ? hw_threads : 1;
+}
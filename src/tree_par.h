@@ -0,0 +1,64 @@
+#ifndef TREE_PAR_H
+#define TREE_PAR_H
+
+#include "tree_common.h"
+
+/*
+    Work-stealing pool, used by parallel operations over trees. Every worker
+    has its own deque of tasks: it pushes and pops its tasks at the back, and
+    idle workers steal from the front of other deques, where the oldest (and
+    usually the biggest) tasks are.
+    Workers live only during one _tree_par_run() call.
+*/
+
+//! @attention ONLY FOR INTERNAL USE!
+struct TreeParTask
+{
+    const TreeNode *node    = NULL;
+    void *arg               = NULL;
+};
+
+//! @attention ONLY FOR INTERNAL USE!
+struct TreeParPool;
+
+//! @brief Runs 'task' on the worker with id 'worker_id' (ids are in [0, threads_count)).
+typedef void (*tree_par_run_t)( TreeParPool *pool, size_t worker_id, TreeParTask task );
+
+//! @attention ONLY FOR INTERNAL USE!
+//! @brief Runs 'tasks' and all tasks, forked by them, on 'threads_count' threads
+//! (the calling thread is one of them), and returns when all of them are done.
+//! Initial tasks are dealt to the workers in turn.
+//! @note If some threads can't be started, the work is done by fewer threads.
+TreeStatus _tree_par_run(   size_t threads_count,
+                            tree_par_run_t run,
+                            void *ctx,
+                            const TreeParTask *tasks,
+                            size_t tasks_count );
+
+//! @attention ONLY FOR INTERNAL USE!
+void *_tree_par_ctx( TreeParPool *pool );
+
+//! @attention ONLY FOR INTERNAL USE!
+//! @brief Pushes 'task' into the deque of the worker.
+//! @return 1 if the task is pushed, 0 if there is no memory for it
+//! (so the caller must do it by itself).
+int _tree_par_fork( TreeParPool *pool, size_t worker_id, TreeParTask task );
+
+//! @attention ONLY FOR INTERNAL USE!
+//! @brief Returns 1 if it's worth to fork a task now, that is the deque of the worker
+//! is empty (so there is nothing to steal from it).
+int _tree_par_wants_fork( TreeParPool *pool, size_t worker_id );
+
+//! @attention ONLY FOR INTERNAL USE!
+//! @brief Makes all workers drop their queued tasks and finish as soon as possible.
+void _tree_par_cancel( TreeParPool *pool );
+
+//! @attention ONLY FOR INTERNAL USE!
+int _tree_par_is_cancelled( TreeParPool *pool );
+
+//! @attention ONLY FOR INTERNAL USE!
+//! @brief Turns 'threads_count' from the user into the real number of threads:
+//! 0 means the number of hardware threads.
+size_t _tree_par_threads_count( size_t threads_count );
+
+#endif /* TREE_PAR_H */
@@ -0,0 +1,255 @@
+#include "tree.h"
+#include "tree_alloc.h"
+
+#include <assert.h>
+#include <memory.h>
+
+
+inline uint32_t *node_refs( Tree *tree_ptr, const TreeNode *node_ptr )
+{
+    return _tree_alloc_ref( tree_ptr->alloc, node_ptr );
+}
+
+TreeStatus tree_make_persistent( Tree *tree_ptr )
+{
+    TREE_SELFCHECK(tree_ptr);
+
+    if ( tree_ptr->persistent )
+        return TREE_STATUS_OK;
+
+    if ( tree_ptr->data_dtor_func_ptr )
+        return TREE_STATUS_WARNING_TREE_HAS_DATA_DTOR;
+
+    if ( _tree_alloc_enable_refs( tree_ptr->alloc ) != TREE_ALLOC_OK )
+        return TREE_STATUS_ERROR_MEM_ALLOC;
+
+    // every node of the tree has exactly one link to it, and every loose one -
+    // exactly one owner (the user), so all live blocks are walked, not the root subtree
+    for ( TreeNode *curr = _tree_alloc_first_live( tree_ptr->alloc ); curr;
+          curr = _tree_alloc_next_live( tree_ptr->alloc, curr ) )
+        *node_refs( tree_ptr, curr ) = 1;
+
+    tree_ptr->persistent = true;
+
+    return TREE_STATUS_OK;
+}
+
+TreeStatus tree_snapshot_take( Tree *tree_ptr, TreeSnapshot *snapshot_ptr )
+{
+    TREE_SELFCHECK(tree_ptr);
+    assert(snapshot_ptr);
+
+    if ( !tree_ptr->persistent )
+        return TREE_STATUS_WARNING_TREE_IS_NOT_PERSISTENT;
+
+    if ( tree_ptr->root )
+        _tree_pers_ref( tree_ptr, tree_ptr->root );
+
+    snapshot_ptr->root          = tree_ptr->root;
+    snapshot_ptr->nodes_count   = tree_ptr->nodes_count;
+    snapshot_ptr->depth         = tree_ptr->depth;
+
+    tree_ptr->snapshots_count++;
+
+    return TREE_STATUS_OK;
+}
+
+TreeStatus tree_snapshot_release( Tree *tree_ptr, TreeSnapshot *snapshot_ptr )
+{
+    TREE_SELFCHECK(tree_ptr);
+    assert(snapshot_ptr);
+
+    if ( !tree_ptr->persistent )
+        return TREE_STATUS_WARNING_TREE_IS_NOT_PERSISTENT;
+
+    assert(tree_ptr->snapshots_count > 0);
+
+    if ( snapshot_ptr->root )
+        _tree_pers_unref( tree_ptr, snapshot_ptr->root );
+
+    *snapshot_ptr = {};
+
+    tree_ptr->snapshots_count--;
+
+    return TREE_STATUS_OK;
+}
+
+TreeStatus tree_make_node_writable( Tree *tree_ptr, TreeNode **node_ptr )
+{
+    TREE_SELFCHECK(tree_ptr);
+    assert(node_ptr);
+    assert(*node_ptr);
+
+    if ( !tree_ptr->persistent )
+        return TREE_STATUS_OK;
+
+    TreeNode *node = *node_ptr;
+
+    // number of nodes from 'node' up to the topmost shared one, inclusive
+    size_t copies_count = 0;
+    size_t dist = 0;
+    for ( TreeNode *curr = node; curr; curr = tree_node_parent(curr) )
+    {
+        dist++;
+        if ( *node_refs( tree_ptr, curr ) > 1 )
+            copies_count = dist;
+    }
+
+    if ( copies_count == 0 )
+        return TREE_STATUS_OK;
+
+    // all blocks are taken first, so that nothing is changed if there is no memory;
+    // copies are linked by parent links, starting with the copy of 'node'
+    TreeNode *bottom_copy   = NULL;
+    TreeNode *prev_copy     = NULL;
+    TreeNode *orig          = node;
+    for (size_t ind = 0; ind < copies_count; ind++, orig = tree_node_parent(orig))
+    {
+        char *new_mem = (char *) _tree_alloc_new( tree_ptr->alloc );
+        if (!new_mem)
+        {
+            while (bottom_copy)
+            {
+                TreeNode *next_copy = tree_node_parent(bottom_copy);
+                _tree_alloc_del( tree_ptr->alloc, bottom_copy );
+                bottom_copy = ( bottom_copy == prev_copy ? NULL : next_copy );
+            }
+            return TREE_STATUS_ERROR_MEM_ALLOC;
+        }
+
+        TreeNode *copy = (TreeNode *) new_mem;
+#ifndef TREE_COMPACT_NODES
+        copy->data_ptr = (void*) (new_mem + sizeof(TreeNode));
+#endif
+        memcpy( tree_node_data(copy), tree_node_data(orig), tree_ptr->data_size );
+        tree_node_set_level( copy, tree_node_level(orig) );
+        if ( tree_ptr->hash_cache )
+            *_tree_alloc_hash( tree_ptr->alloc, copy ) = *_tree_alloc_hash( tree_ptr->alloc, orig );
+        tree_node_set_parent( copy, tree_node_parent(orig) );
+
+        if (prev_copy)
+            tree_node_set_parent( prev_copy, copy );
+        else
+            bottom_copy = copy;
+        prev_copy = copy;
+    }
+
+    // copies take place of originals in the current version, originals stay in snapshots
+    TreeNode *orig_child = NULL;
+    TreeNode *copy_child = NULL;
+    TreeNode *copy = bottom_copy;
+    orig = node;
+    for (size_t ind = 0; ind < copies_count; ind++)
+    {
+        TreeNode *left  = tree_node_left(orig);
+        TreeNode *right = tree_node_right(orig);
+
+        if ( left && left == orig_child )
+            tree_node_set_left( copy, copy_child );
+        else if ( left )
+        {
+            tree_node_set_left( copy, left );
+            tree_node_set_parent( left, copy );
+            _tree_pers_ref( tree_ptr, left );
+        }
+
+        if ( right && right == orig_child )
+            tree_node_set_right( copy, copy_child );
+        else if ( right )
+        {
+            tree_node_set_right( copy, right );
+            tree_node_set_parent( right, copy );
+            _tree_pers_ref( tree_ptr, right );
+        }
+
+        orig_child  = orig;
+        copy_child  = copy;
+        orig        = tree_node_parent(orig);
+        copy        = tree_node_parent(copy);
+    }
+
+    // 'orig_child' is the topmost shared node, 'orig' is its parent (which is writable)
+    if (orig)
+    {
+        if ( tree_node_left(orig) == orig_child )
+            tree_node_set_left( orig, copy_child );
+        else
+            tree_node_set_right( orig, copy_child );
+    }
+    else
+        tree_ptr->root = copy_child;
+
+    _tree_pers_unref( tree_ptr, orig_child );
+
+    *node_ptr = bottom_copy;
+
+    return TREE_STATUS_OK;
+}
+
+int _tree_pers_is_writable( const Tree *tree_ptr, const TreeNode *node_ptr )
+{
+    assert(tree_ptr);
+    assert(node_ptr);
+
+    if ( !tree_ptr->persistent )
+        return 1;
+
+    for ( const TreeNode *curr = node_ptr; curr; curr = tree_node_parent(curr) )
+        if ( *_tree_alloc_ref( tree_ptr->alloc, curr ) > 1 )
+            return 0;
+
+    return 1;
+}
+
+void _tree_pers_ref( Tree *tree_ptr, TreeNode *node_ptr )
+{
+    assert(tree_ptr);
+    assert(node_ptr);
+
+    uint32_t *refs = node_refs( tree_ptr, node_ptr );
+    assert( *refs > 0 && *refs < UINT32_MAX );
+
+    (*refs)++;
+}
+
+void _tree_pers_unref( Tree *tree_ptr, TreeNode *node_ptr )
+{
+    assert(tree_ptr);
+    assert(node_ptr);
+
+    // nodes to be freed are kept in a stack, linked by their parent links
+    // (they aren't in any version of the tree, so nobody needs them)
+    TreeNode *dead_head = NULL;
+
+    uint32_t *refs = node_refs( tree_ptr, node_ptr );
+    assert(*refs > 0);
+    if ( --(*refs) == 0 )
+    {
+        tree_node_set_parent( node_ptr, NULL );
+        dead_head = node_ptr;
+    }
+
+    while (dead_head)
+    {
+        TreeNode *dead = dead_head;
+        dead_head = tree_node_parent(dead);
+
+        TreeNode *children[2] = { tree_node_left(dead), tree_node_right(dead) };
+        for (size_t ind = 0; ind < 2; ind++)
+        {
+            TreeNode *child = children[ind];
+            if (!child)
+                continue;
+
+            uint32_t *child_refs = node_refs( tree_ptr, child );
+            assert(*child_refs > 0);
+            if ( --(*child_refs) == 0 )
+            {
+                tree_node_set_parent( child, dead_head );
+                dead_head = child;
+            }
+        }
+
+        _tree_alloc_del( tree_ptr->alloc, dead );
+    }
+}
@@ -0,0 +1,153 @@
+#ifndef TREE_PERSIST_H
+#define TREE_PERSIST_H
+
+#include "tree_common.h"
+#include "tree_iter.h"
+
+#include <stdlib.h>
+
+/*
+    Persistent mode. A snapshot of a persistent tree is taken in O(1): it just holds
+    the root of the tree. Nodes are shared by the tree and its snapshots, and every node
+    has a reference counter (in a side table of the allocator), which counts links to it
+    from other nodes, from the tree and from snapshots.
+    Before a node is changed, it must be made writable by tree_make_node_writable(),
+    which copies the node and its ancestors up to the topmost shared one (the path
+    from the root to the node), so a write costs O(depth), and untouched subtrees
+    stay shared. Nodes, which aren't shared, are changed in place.
+    Functions of tree.h return TREE_STATUS_WARNING_NODE_IS_SHARED, if they are asked
+    to change links or data of a shared node.
+
+    Rules for snapshots:
+    - nodes of a snapshot are read only through child links and data
+      (tree_snapshot_visit() or tree_node_left/right/data()), because parent links
+      and levels of shared nodes belong to the current version of the tree;
+    - snapshot can be read by other threads while the tree is being changed,
+      but tree_snapshot_take() and tree_snapshot_release() must not run
+      at the same time as changes of the tree;
+    - all snapshots become invalid after tree_dtor().
+*/
+
+//! @brief Read-only version of a persistent tree.
+//! @attention Fields mustn't be changed by the user.
+struct TreeSnapshot
+{
+    TreeNode *root      = NULL;
+    size_t nodes_count  = 0;
+    size_t depth        = 0;
+};
+
+//! @brief Turns on persistent mode of the tree (it can't be turned off).
+//! Takes time proportional to the number of nodes of the tree (loose ones included).
+//! @note Data of nodes is copied byte by byte, when nodes are copied,
+//! so the tree mustn't have 'data_dtor_func_ptr'.
+TreeStatus tree_make_persistent( Tree *tree_ptr );
+
+//! @brief Takes a snapshot of the current version of the persistent tree in O(1).
+TreeStatus tree_snapshot_take( Tree *tree_ptr, TreeSnapshot *snapshot_ptr );
+
+//! @brief Releases the snapshot, nodes, which are used only by it, are freed.
+TreeStatus tree_snapshot_release( Tree *tree_ptr, TreeSnapshot *snapshot_ptr );
+
+//! @brief Makes node of the current version of the tree writable: if it or one
+//! of its ancestors is shared, copies the path from the topmost shared ancestor down
+//! to the node, and writes the copy of the node by 'node_ptr'. Otherwise does nothing.
+//! @note Old pointers to the copied nodes keep pointing to nodes of snapshots.
+//! If memory can't be allocated, nothing is changed.
+TreeStatus tree_make_node_writable( Tree *tree_ptr, TreeNode **node_ptr );
+
+//! @attention ONLY FOR INTERNAL USE!
+//! @brief Returns 1 if the node and all its ancestors are not shared.
+int _tree_pers_is_writable( const Tree *tree_ptr, const TreeNode *node_ptr );
+
+//! @attention ONLY FOR INTERNAL USE!
+//! @brief Adds one link to the node.
+void _tree_pers_ref( Tree *tree_ptr, TreeNode *node_ptr );
+
+//! @attention ONLY FOR INTERNAL USE!
+//! @brief Removes one link to the node. If there are no links left, frees the node
+//! and removes its links to its children, and so on.
+//! @note Node must already be out of the current version of the tree.
+void _tree_pers_unref( Tree *tree_ptr, TreeNode *node_ptr );
+
+//! @brief Calls 'func( const TreeNode *node )' for every node of the snapshot in given order.
+//! @note Parent links are not used (see above), nodes of the current path are
+//! kept in ONE array of (depth of the snapshot + 1) elements.
+template <TreeIterOrder order, typename Func>
+inline TreeStatus tree_snapshot_visit( const TreeSnapshot *snapshot_ptr, Func &&func )
+{
+    static_assert( order != TREE_ITER_LEVEL_ORDER, "level order is not supported for snapshots" );
+
+    assert(snapshot_ptr);
+
+    if (!snapshot_ptr->root)
+        return TREE_STATUS_OK;
+
+    const TreeNode **stack = (const TreeNode **) calloc( snapshot_ptr->depth + 1, sizeof(TreeNode *) );
+    if (!stack)
+        return TREE_STATUS_ERROR_MEM_ALLOC;
+    size_t size = 0;
+
+    if constexpr ( order == TREE_ITER_PREORDER )
+    {
+        stack[size++] = snapshot_ptr->root;
+        while (size)
+        {
+            const TreeNode *curr = stack[--size];
+
+            if ( tree_node_right(curr) )
+                stack[size++] = tree_node_right(curr);
+            if ( tree_node_left(curr) )
+                stack[size++] = tree_node_left(curr);
+
+            func( curr );
+        }
+    }
+    else if constexpr ( order == TREE_ITER_INORDER )
+    {
+        const TreeNode *curr = snapshot_ptr->root;
+        while ( curr || size )
+        {
+            for (; curr; curr = tree_node_left(curr))
+                stack[size++] = curr;
+
+            curr = stack[--size];
+            const TreeNode *right = tree_node_right(curr);
+
+            func( curr );
+
+            curr = right;
+        }
+    }
+    else
+    {
+        const TreeNode *curr = snapshot_ptr->root;
+        const TreeNode *last = NULL;
+        while ( curr || size )
+        {
+            if (curr)
+            {
+                stack[size++] = curr;
+                curr = tree_node_left(curr);
+                continue;
+            }
+
+            const TreeNode *top = stack[size - 1];
+            if ( tree_node_right(top) && tree_node_right(top) != last )
+            {
+                curr = tree_node_right(top);
+                continue;
+            }
+
+            size--;
+            last = top;
+            func( top );
+        }
+    }
+
+    free( stack );
+
+    return TREE_STATUS_OK;
+}
+
+#endif /* TREE_PERSIST_H */
@@ -8,6 +8,8 @@ DEF_TREE_STATUS(WARNING_RIGHT_CHILD_IS_OCCUPIED,    "WARNING_RIGHT_CHILD_IS_OCCU
 
 DEF_TREE_STATUS(ERROR_MEM_ALLOC,                    "ERROR_MEM_ALLOC")
 
+DEF_TREE_STATUS(ERROR_ALLOC_INIT,                   "ERROR_ALLOC_INIT")
+
 DEF_TREE_STATUS(WARNING_REQUEST_TO_DEL_NULL_NODE,   "WARNING_REQUEST_TO_DEL_NULL_NODE")
 
 DEF_TREE_STATUS(WARNING_REQUEST_TO_DEL_NOT_A_LEAF,  "WARNING_REQUEST_TO_DEL_NOT_A_LEAF")
@@ -21,3 +23,17 @@ DEF_TREE_STATUS(ERROR_CANT_CREATE_DUMP_DIR,         "ERROR_CANT_CREATE_DUMP_DIR"
 DEF_TREE_STATUS(ERROR_CANT_OPEN_DUMP_FILE,          "ERROR_CANT_OPEN_DUMP_FILE")
 
 DEF_TREE_STATUS(ERROR_TOO_LONG_CMD_GEN_DUMP_IMG,    "ERROR_TOO_LONG_CMD_GEN_DUMP_IMG")
+
+DEF_TREE_STATUS(ERROR_FILE_IO,                      "ERROR_FILE_IO")
+
+DEF_TREE_STATUS(ERROR_BAD_FILE_FORMAT,              "ERROR_BAD_FILE_FORMAT")
+
+DEF_TREE_STATUS(ERROR_DATA_SIZE_MISMATCH,           "ERROR_DATA_SIZE_MISMATCH")
+
+DEF_TREE_STATUS(WARNING_TREE_IS_NOT_PERSISTENT,     "WARNING_TREE_IS_NOT_PERSISTENT")
+
+DEF_TREE_STATUS(WARNING_TREE_HAS_DATA_DTOR,         "WARNING_TREE_HAS_DATA_DTOR")
+
+DEF_TREE_STATUS(WARNING_NODE_IS_SHARED,             "WARNING_NODE_IS_SHARED")
+
+DEF_TREE_STATUS(WARNING_TREE_HAS_UNREACHABLE_NODES, "WARNING_TREE_HAS_UNREACHABLE_NODES")
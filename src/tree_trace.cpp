@@ -0,0 +1,145 @@
+#include "tree.h"
+
+#ifdef TREE_DO_TRACE
+
+#include <assert.h>
+#include <time.h>
+
+
+static TreeTraceOpStats trace_stats[TREE_TRACE_OPS_COUNT] = {};
+
+static tree_trace_hook_t trace_hook = NULL;
+
+//! @brief Number of traced calls, which are running in this thread now (nested ones included).
+static thread_local size_t calls_depth = 0;
+
+//! @brief Nodes, touched by the outer traced call of this thread, besides created and freed ones.
+static thread_local size_t extra_touched = 0;
+
+inline uint64_t now_ns()
+{
+    timespec ts = {};
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+inline size_t latency_bucket( uint64_t latency_ns )
+{
+    size_t bucket = (size_t) ( 63 - __builtin_clzll( latency_ns | 1 ) );
+
+    return ( bucket < TREE_TRACE_LATENCY_BUCKETS ? bucket : TREE_TRACE_LATENCY_BUCKETS - 1 );
+}
+
+TreeTraceScope_::TreeTraceScope_( const Tree *tree_ptr_, TreeTraceOp op_ )
+{
+    assert(op_ < TREE_TRACE_OPS_COUNT);
+
+    if ( calls_depth++ != 0 )
+        return;
+
+    tree_ptr        = tree_ptr_;
+    op              = op_;
+    nodes_count     = ( tree_ptr_ ? tree_ptr_->nodes_count : 0 );
+    outer           = true;
+    extra_touched   = 0;
+    start_ns        = now_ns();
+}
+
+TreeTraceScope_::~TreeTraceScope_()
+{
+    calls_depth--;
+    if ( !outer )
+        return;
+
+    TreeTraceEvent event = {};
+    event.latency_ns    = now_ns() - start_ns;
+    event.op            = op;
+    event.tree_ptr      = tree_ptr;
+
+    size_t nodes_count_after = ( tree_ptr ? tree_ptr->nodes_count : 0 );
+    event.nodes_touched = extra_touched + ( nodes_count_after > nodes_count ? nodes_count_after - nodes_count
+                                                                            : nodes_count - nodes_count_after );
+
+    TreeTraceOpStats *stats = &trace_stats[op];
+    __atomic_fetch_add( &stats->calls,          1,                      __ATOMIC_RELAXED );
+    __atomic_fetch_add( &stats->nodes_touched,  event.nodes_touched,    __ATOMIC_RELAXED );
+    __atomic_fetch_add( &stats->total_ns,       event.latency_ns,       __ATOMIC_RELAXED );
+    __atomic_fetch_add( &stats->latency_hist[ latency_bucket( event.latency_ns ) ], 1, __ATOMIC_RELAXED );
+
+    tree_trace_hook_t hook = __atomic_load_n( &trace_hook, __ATOMIC_ACQUIRE );
+    if ( hook )
+        hook( &event );
+}
+
+void _tree_trace_touch( size_t count )
+{
+    extra_touched += count;
+}
+
+void tree_trace_set_hook( tree_trace_hook_t hook )
+{
+    __atomic_store_n( &trace_hook, hook, __ATOMIC_RELEASE );
+}
+
+void tree_trace_get_stats( TreeTraceOp op, TreeTraceOpStats *stats )
+{
+    assert(op < TREE_TRACE_OPS_COUNT);
+    assert(stats);
+
+    const TreeTraceOpStats *src = &trace_stats[op];
+
+    stats->calls            = __atomic_load_n( &src->calls,         __ATOMIC_RELAXED );
+    stats->nodes_touched    = __atomic_load_n( &src->nodes_touched, __ATOMIC_RELAXED );
+    stats->total_ns         = __atomic_load_n( &src->total_ns,      __ATOMIC_RELAXED );
+    for (size_t bucket = 0; bucket < TREE_TRACE_LATENCY_BUCKETS; bucket++)
+        stats->latency_hist[bucket] = __atomic_load_n( &src->latency_hist[bucket], __ATOMIC_RELAXED );
+}
+
+void tree_trace_reset()
+{
+    for (size_t op = 0; op < TREE_TRACE_OPS_COUNT; op++)
+    {
+        TreeTraceOpStats *stats = &trace_stats[op];
+
+        __atomic_store_n( &stats->calls,            0, __ATOMIC_RELAXED );
+        __atomic_store_n( &stats->nodes_touched,    0, __ATOMIC_RELAXED );
+        __atomic_store_n( &stats->total_ns,         0, __ATOMIC_RELAXED );
+        for (size_t bucket = 0; bucket < TREE_TRACE_LATENCY_BUCKETS; bucket++)
+            __atomic_store_n( &stats->latency_hist[bucket], 0, __ATOMIC_RELAXED );
+    }
+}
+
+void tree_trace_print( FILE *stream )
+{
+    assert(stream);
+
+    fprintf( stream, "%-32s %12s %14s %16s %12s\n", "operation", "calls", "nodes_touched", "total_ns", "mean_ns" );
+
+    for (size_t op = 0; op < TREE_TRACE_OPS_COUNT; op++)
+    {
+        TreeTraceOpStats stats = {};
+        tree_trace_get_stats( (TreeTraceOp) op, &stats );
+        if ( stats.calls == 0 )
+            continue;
+
+        fprintf( stream, "%-32s %12zu %14zu %16llu %12llu\n", tree_trace_op_names[op],
+                 stats.calls, stats.nodes_touched, (unsigned long long) stats.total_ns,
+                 (unsigned long long) ( stats.total_ns / stats.calls ) );
+
+        fprintf( stream, "    latency:" );
+        for (size_t bucket = 0; bucket < TREE_TRACE_LATENCY_BUCKETS; bucket++)
+        {
+            if ( !stats.latency_hist[bucket] )
+                continue;
+
+            if ( bucket == TREE_TRACE_LATENCY_BUCKETS - 1 )
+                fprintf( stream, " >=%llu ns: %zu", 1ULL << bucket, stats.latency_hist[bucket] );
+            else
+                fprintf( stream, " <%llu ns: %zu",  2ULL << bucket, stats.latency_hist[bucket] );
+        }
+        fputc( '\n', stream );
+    }
+}
+
+#endif /* TREE_DO_TRACE */
@@ -0,0 +1,108 @@
+#ifndef TREE_TRACE_H
+#define TREE_TRACE_H
+
+#include "tree_common.h"
+
+/*
+    Tracing of operations of tree.h and tree_layout.h (see tree_trace_ops.h), enabled by TREE_DO_TRACE.
+    For every operation number of calls, number of touched nodes and histogram
+    of latencies are collected (for all trees and threads together), and the hook,
+    if it is set, is called after every traced call.
+    Touched nodes are nodes, which are created or freed by the call (so change
+    nodes_count), plus nodes, which are moved to other levels or copied into another tree.
+    If a traced operation calls another one, only the outer call is traced.
+    Without TREE_DO_TRACE nothing of this is compiled, and operations are not changed at all.
+*/
+
+#ifdef TREE_DO_TRACE
+
+#define DEF_TREE_TRACE_OP(name, func_name) TREE_TRACE_OP_##name,
+enum TreeTraceOp
+{
+    #include "tree_trace_ops.h"
+    TREE_TRACE_OPS_COUNT
+};
+#undef DEF_TREE_TRACE_OP
+
+#define DEF_TREE_TRACE_OP(name, func_name) func_name,
+const char * const tree_trace_op_names[] =
+{
+    #include "tree_trace_ops.h"
+};
+#undef DEF_TREE_TRACE_OP
+
+//! @brief Bucket i of the histogram counts calls, which took [2^i, 2^(i+1)) ns
+//! (bucket 0 also counts calls, faster than 1 ns, the last one counts all slower calls).
+const size_t TREE_TRACE_LATENCY_BUCKETS = 32;
+
+struct TreeTraceOpStats
+{
+    size_t calls            = 0;
+    size_t nodes_touched    = 0;
+    uint64_t total_ns       = 0;
+    size_t latency_hist[TREE_TRACE_LATENCY_BUCKETS] = {};
+};
+
+//! @brief Is given to the hook after every traced call.
+struct TreeTraceEvent
+{
+    TreeTraceOp op          = TREE_TRACE_OPS_COUNT;
+    const Tree *tree_ptr    = NULL; //< Tree (for tree_copy() - the source), may be already destructed.
+    size_t nodes_touched    = 0;
+    uint64_t latency_ns     = 0;
+};
+
+//! @brief Is called from the thread, which called the operation.
+typedef void (*tree_trace_hook_t)( const TreeTraceEvent *event );
+
+//! @brief Sets the hook for all trees (NULL removes it).
+void tree_trace_set_hook( tree_trace_hook_t hook );
+
+//! @brief Writes statistics of the operation, collected since the start or tree_trace_reset().
+void tree_trace_get_stats( TreeTraceOp op, TreeTraceOpStats *stats );
+
+//! @brief Clears statistics of all operations.
+void tree_trace_reset();
+
+//! @brief Prints statistics of all called operations as a table,
+//! with non-empty buckets of latency histograms.
+void tree_trace_print( FILE *stream );
+
+
+//! @attention ONLY FOR INTERNAL USE!
+//! @brief Traces the call from its creation till its destruction (see TREE_TRACE).
+struct TreeTraceScope_
+{
+    const Tree *tree_ptr    = NULL;
+    TreeTraceOp op          = TREE_TRACE_OPS_COUNT;
+    size_t nodes_count      = 0;    //< nodes_count of the tree before the call.
+    uint64_t start_ns       = 0;
+    bool outer              = false;
+
+    TreeTraceScope_( const Tree *tree_ptr_, TreeTraceOp op_ );
+    ~TreeTraceScope_();
+
+    TreeTraceScope_( const TreeTraceScope_ & ) = delete;
+    TreeTraceScope_ &operator=( const TreeTraceScope_ & ) = delete;
+};
+
+//! @attention ONLY FOR INTERNAL USE!
+//! @brief Adds 'count' to touched nodes of the current outer call of this thread.
+void _tree_trace_touch( size_t count );
+
+//! @attention ONLY FOR INTERNAL USE!
+//! @brief Traces the rest of the function as operation 'op' (name from tree_trace_ops.h).
+#define TREE_TRACE( tree_ptr, op ) \
+    TreeTraceScope_ tree_trace_scope_( tree_ptr, TREE_TRACE_OP_##op )
+
+//! @attention ONLY FOR INTERNAL USE!
+#define TREE_TRACE_TOUCH( count ) _tree_trace_touch( count )
+
+#else /* NOT TREE_DO_TRACE */
+
+#define TREE_TRACE( tree_ptr, op ) ((void) 0)
+#define TREE_TRACE_TOUCH( count ) ((void) (count))
+
+#endif /* TREE_DO_TRACE */
+
+#endif /* TREE_TRACE_H */
@@ -0,0 +1,45 @@
+// DEF_TREE_TRACE_OP( name, func_name ): operation of tree.h or tree_layout.h, traced in TREE_DO_TRACE mode.
+
+DEF_TREE_TRACE_OP(INSERT_ROOT,                  "tree_insert_root")
+
+DEF_TREE_TRACE_OP(INSERT_LEFT,                  "tree_insert_data_as_left_child")
+
+DEF_TREE_TRACE_OP(INSERT_RIGHT,                 "tree_insert_data_as_right_child")
+
+DEF_TREE_TRACE_OP(CHANGE_DATA,                  "tree_change_data")
+
+DEF_TREE_TRACE_OP(DELETE_ROOT,                  "tree_delete_root")
+
+DEF_TREE_TRACE_OP(DELETE_LEFT_CHILD,            "tree_delete_left_child")
+
+DEF_TREE_TRACE_OP(DELETE_RIGHT_CHILD,           "tree_delete_right_child")
+
+DEF_TREE_TRACE_OP(DELETE_SUBTREE,               "tree_delete_subtree")
+
+DEF_TREE_TRACE_OP(CLEAR,                        "tree_clear")
+
+DEF_TREE_TRACE_OP(DTOR,                         "tree_dtor")
+
+DEF_TREE_TRACE_OP(COPY,                         "tree_copy")
+
+DEF_TREE_TRACE_OP(COPY_SUBTREE_INTO_LEFT,       "tree_copy_subtree_into_left")
+
+DEF_TREE_TRACE_OP(COPY_SUBTREE_INTO_RIGHT,      "tree_copy_subtree_into_right")
+
+DEF_TREE_TRACE_OP(MIGRATE_INTO_LEFT,            "tree_migrate_into_left")
+
+DEF_TREE_TRACE_OP(MIGRATE_INTO_RIGHT,           "tree_migrate_into_right")
+
+DEF_TREE_TRACE_OP(MIGRATE_INTO_ROOT,            "tree_migrate_into_root")
+
+DEF_TREE_TRACE_OP(HANG_LOOSE_NODE_AT_LEFT,      "tree_hang_loose_node_at_left")
+
+DEF_TREE_TRACE_OP(HANG_LOOSE_NODE_AT_RIGHT,     "tree_hang_loose_node_at_right")
+
+DEF_TREE_TRACE_OP(HANG_LOOSE_NODE_AS_ROOT,      "tree_hang_loose_node_as_root")
+
+DEF_TREE_TRACE_OP(UPDATE_ALL_TREE_LEVELS,       "tree_update_all_tree_levels")
+
+DEF_TREE_TRACE_OP(COMPACT,                      "tree_compact")
+
+DEF_TREE_TRACE_OP(RELAYOUT,                     "tree_relayout")
@@ -0,0 +1,216 @@
+#ifndef TREE_TYPED_H
+#define TREE_TYPED_H
+
+#include "tree.h"
+
+#include <new>
+#include <type_traits>
+#include <utility>
+
+/*
+    Typed front end over the same engine. Data of type T is stored inline
+    right after TreeNode (as usual), but its size and offset are known at
+    compile time, it is constructed in place and destructors are not
+    called at all if T is trivially destructible.
+
+    All functions from tree.h can be used with '&typed_tree_ptr->tree',
+    EXCEPT for those copying data byte by byte (tree_copy*, tree_change_data,
+    tree_get_data), if T is not trivially copyable.
+*/
+
+template <typename T>
+struct TypedTree
+{
+    static_assert( alignof(T) <= TREE_DATA_ALIGN && sizeof(TreeNode) % alignof(T) == 0,
+                   "T is aligned stricter than data of tree nodes" );
+
+    Tree tree = {};
+};
+
+//! @brief Returns reference to the data of type T, stored in the node.
+//! @note Offset of the data is a compile-time constant.
+template <typename T>
+inline T &typed_tree_data( const TreeNode *node_ptr )
+{
+    assert(node_ptr);
+
+    return *(T *) ( (uintptr_t) node_ptr + sizeof(TreeNode) );
+}
+
+template <typename T>
+inline void typed_tree_data_dtor_( void *data_ptr )
+{
+    ((T *) data_ptr)->~T();
+}
+
+template <typename T>
+inline TreeStatus typed_tree_ctor_( TypedTree<T> *tree_ptr,
+#ifdef TREE_DO_DUMP
+                                    void (*print_data_func_ptr)(FILE* stream, void *data_ptr),
+                                    TreeOrigInfo orig_info,
+#endif
+                                    size_t typical_num_of_nodes )
+{
+    assert(tree_ptr);
+
+    void (*data_dtor_func_ptr)(void *data_ptr) = NULL;
+    if ( !std::is_trivially_destructible<T>::value )
+        data_dtor_func_ptr = typed_tree_data_dtor_<T>;
+
+    return tree_ctor_(  &tree_ptr->tree,
+                        sizeof(T),
+#ifdef TREE_DO_DUMP
+                        print_data_func_ptr,
+                        orig_info,
+#endif
+                        typical_num_of_nodes,
+                        data_dtor_func_ptr );
+}
+
+#ifdef TREE_DO_DUMP
+//! @param [in] tree_ptr TypedTree pointer.
+//! @param [in] typical_num_of_nodes Expected maximum number of nodes in the tree (might be exceeded).
+//! @param [in] print_data_func_ptr Pointer to function, printing element.
+//! void data_print(FILE *stream, void *data_ptr).
+#define typed_tree_ctor( tree_ptr, typical_num_of_nodes, print_data_func_ptr )   \
+    typed_tree_ctor_(   tree_ptr,               \
+                        print_data_func_ptr,    \
+                        {                       \
+                            #tree_ptr,          \
+                            __FILE__,           \
+                            __LINE__,           \
+                            __func__            \
+                        },                      \
+                        typical_num_of_nodes    \
+                    )
+#else /* NOT TREE_DO_DUMP */
+//! @param [in] tree_ptr TypedTree pointer.
+//! @param [in] typical_num_of_nodes Expected maximum number of nodes in the tree (might be exceeded).
+#define typed_tree_ctor( tree_ptr__, typical_num_of_nodes__ ) \
+    typed_tree_ctor_( tree_ptr__, typical_num_of_nodes__ )
+#endif /* TREE_DO_DUMP */
+
+template <typename T>
+inline TreeStatus typed_tree_dtor( TypedTree<T> *tree_ptr )
+{
+    assert(tree_ptr);
+
+    return tree_dtor( &tree_ptr->tree );
+}
+
+//! @brief Creates new node, which data is constructed in place from 'args'.
+//! The node is not linked to anything except 'parent' (see op_new_TreeNode()).
+//! @return The new node or NULL if memory can't be allocated.
+template <typename T, typename... Args>
+inline TreeNode *typed_tree_new_node_( TypedTree<T> *tree_ptr, TreeNode *parent, Args&&... args )
+{
+    TreeNode *new_node = op_new_empty_TreeNode( &tree_ptr->tree, parent );
+    if (!new_node)
+        return NULL;
+
+    new ( &typed_tree_data<T>(new_node) ) T( std::forward<Args>(args)... );
+
+    return new_node;
+}
+
+//! @brief Inserts data, constructed in place from 'args', into the empty tree as the root.
+//! @note If the tree is not empty (root node already exists), error is returned.
+template <typename T, typename... Args>
+inline TreeStatus typed_tree_emplace_root( TypedTree<T> *tree_ptr, Args&&... args )
+{
+    TREE_SELFCHECK(&tree_ptr->tree);
+
+    if ( tree_ptr->tree.root )
+        return TREE_STATUS_WARNING_ROOT_ALREADY_EXISTS;
+
+    TreeNode *new_node = typed_tree_new_node_( tree_ptr, NULL, std::forward<Args>(args)... );
+    if (!new_node)
+        return TREE_STATUS_ERROR_MEM_ALLOC;
+
+    tree_ptr->tree.root = new_node;
+
+    return TREE_STATUS_OK;
+}
+
+//! @brief Inserts data, constructed in place from 'args', as the left child of the node.
+//! @note If left child of the specified node is occupied, error is returned and nothing is changed.
+template <typename T, typename... Args>
+inline TreeStatus typed_tree_emplace_left( TypedTree<T> *tree_ptr, TreeNode *node_ptr, Args&&... args )
+{
+    TREE_SELFCHECK(&tree_ptr->tree);
+    assert(node_ptr);
+
+    if ( tree_node_left(node_ptr) )
+        return TREE_STATUS_WARNING_LEFT_CHILD_IS_OCCUPIED;
+
+    if ( !_tree_pers_is_writable( &tree_ptr->tree, node_ptr ) )
+        return TREE_STATUS_WARNING_NODE_IS_SHARED;
+
+    TreeNode *new_node = typed_tree_new_node_( tree_ptr, node_ptr, std::forward<Args>(args)... );
+    if (!new_node)
+        return TREE_STATUS_ERROR_MEM_ALLOC;
+
+    tree_node_set_left( node_ptr, new_node );
+    _tree_hash_invalidate( &tree_ptr->tree, node_ptr );
+
+    return TREE_STATUS_OK;
+}
+
+//! @brief Inserts data, constructed in place from 'args', as the right child of the node.
+//! @note If right child of the specified node is occupied, error is returned and nothing is changed.
+template <typename T, typename... Args>
+inline TreeStatus typed_tree_emplace_right( TypedTree<T> *tree_ptr, TreeNode *node_ptr, Args&&... args )
+{
+    TREE_SELFCHECK(&tree_ptr->tree);
+    assert(node_ptr);
+
+    if ( tree_node_right(node_ptr) )
+        return TREE_STATUS_WARNING_RIGHT_CHILD_IS_OCCUPIED;
+
+    if ( !_tree_pers_is_writable( &tree_ptr->tree, node_ptr ) )
+        return TREE_STATUS_WARNING_NODE_IS_SHARED;
+
+    TreeNode *new_node = typed_tree_new_node_( tree_ptr, node_ptr, std::forward<Args>(args)... );
+    if (!new_node)
+        return TREE_STATUS_ERROR_MEM_ALLOC;
+
+    tree_node_set_right( node_ptr, new_node );
+    _tree_hash_invalidate( &tree_ptr->tree, node_ptr );
+
+    return TREE_STATUS_OK;
+}
+
+//! @brief Creates a loose node, see op_new_TreeNode() and tree_hang_loose_node_*().
+template <typename T, typename... Args>
+inline TreeNode *typed_tree_emplace_loose( TypedTree<T> *tree_ptr, Args&&... args )
+{
+    assert(tree_ptr);
+
+    return typed_tree_new_node_( tree_ptr, NULL, std::forward<Args>(args)... );
+}
+
+//! @brief Assigns 'value' to the data of the node (no destruction and construction).
+template <typename T, typename U>
+inline TreeStatus typed_tree_set_data( TypedTree<T> *tree_ptr, TreeNode *node_ptr, U&& value )
+{
+    TREE_SELFCHECK(&tree_ptr->tree);
+    assert(node_ptr);
+
+    if ( !_tree_pers_is_writable( &tree_ptr->tree, node_ptr ) )
+        return TREE_STATUS_WARNING_NODE_IS_SHARED;
+
+    typed_tree_data<T>(node_ptr) = std::forward<U>(value);
+    _tree_hash_invalidate( &tree_ptr->tree, node_ptr );
+
+    return TREE_STATUS_OK;
+}
+
+template <typename T>
+inline TreeNode *typed_tree_root( const TypedTree<T> *tree_ptr )
+{
+    assert(tree_ptr);
+
+    return tree_ptr->tree.root;
+}
+
+#endif /* TREE_TYPED_H */
@@ -1,40 +1,95 @@
 //DSL
 #define _TREE_PTR (tree_ptr)
+#define _SCAN (scan)
 
 
 // VERIFY FLAGS
+// DEF_TREE_VERIFY_FLAG( name, message, level, cond ): 'cond' is checked only if
+// verification of at least 'level' is asked for (see TreeVerifyLevel).
+// Conditions of TREE_VERIFY_FULL and TREE_VERIFY_DEEP levels use results of
+// ONE walk over all nodes, which is done by tree_verify_level().
+
 DEF_TREE_VERIFY_FLAG
 (
     NULL_TREE_PNT,
     "NULL_TREE_PNT",
+    TREE_VERIFY_CHEAP,
     (!_TREE_PTR)
 )
 
 DEF_TREE_VERIFY_FLAG
 (
-    WRONG_HEAD_OR_NODES_COUNT,
-    "WRONG_HEAD_OR_NODES_COUNT",
+    WRONG_ROOT_OR_NODES_COUNT,
+    "WRONG_ROOT_OR_NODES_COUNT",
+    TREE_VERIFY_CHEAP,
     (_TREE_PTR &&
-    ((_TREE_PTR->nodes_count == 0 && _TREE_PTR->head_of_all_nodes)
-  || (_TREE_PTR->nodes_count != 0 && !_TREE_PTR->head_of_all_nodes)) )
+    _TREE_PTR->nodes_count == 0 && _TREE_PTR->root)
+)
+
+DEF_TREE_VERIFY_FLAG
+(
+    WRONG_ROOT_PARENT_OR_LEVEL,
+    "WRONG_ROOT_PARENT_OR_LEVEL",
+    TREE_VERIFY_CHEAP,
+    (_TREE_PTR && _TREE_PTR->root &&
+    (tree_node_parent(_TREE_PTR->root) || tree_node_level(_TREE_PTR->root) != 0))
+)
+
+DEF_TREE_VERIFY_FLAG
+(
+    WRONG_DEPTH_ACCORDING_TO_LEVEL_HIST,
+    "WRONG_DEPTH_ACCORDING_TO_LEVEL_HIST",
+    TREE_VERIFY_CHEAP,
+    (_TREE_PTR && _TREE_PTR->alloc && _TREE_PTR->nodes_count != 0 &&
+    (_TREE_PTR->depth >= _TREE_PTR->level_hist_cap || _TREE_PTR->level_hist[_TREE_PTR->depth] == 0))
 )
 
 DEF_TREE_VERIFY_FLAG
 (
-    INVALID_NODES_COUNT_ACCORDING_TO_LIST,
-    "INVALID_NODES_COUNT_ACCORDING_TO_LIST",
+    INVALID_NODES_COUNT_ACCORDING_TO_LIVE_NODES,
+    "INVALID_NODES_COUNT_ACCORDING_TO_LIVE_NODES",
+    TREE_VERIFY_FULL,
     (_TREE_PTR &&
-    !verify_check_nodes_count(_TREE_PTR))
+    !_SCAN.count_matches)
 )
 
 DEF_TREE_VERIFY_FLAG
 (
     SOME_NODES_HAVE_NULL_DATA_POINTER,
     "SOME_NODES_HAVE_NULL_DATA_POINTER",
+    TREE_VERIFY_FULL,
+    (_TREE_PTR &&
+    _SCAN.null_data_count != 0)
+)
+
+DEF_TREE_VERIFY_FLAG
+(
+    PARENT_AND_CHILD_LINKS_DONT_MATCH,
+    "PARENT_AND_CHILD_LINKS_DONT_MATCH",
+    TREE_VERIFY_DEEP,
+    (_TREE_PTR &&
+    _SCAN.bad_links_count != 0)
+)
+
+DEF_TREE_VERIFY_FLAG
+(
+    WRONG_LEVELS_OF_NODES,
+    "WRONG_LEVELS_OF_NODES",
+    TREE_VERIFY_DEEP,
+    (_TREE_PTR &&
+    _SCAN.bad_levels_count != 0)
+)
+
+DEF_TREE_VERIFY_FLAG
+(
+    LEVEL_HIST_DOESNT_MATCH_NODES,
+    "LEVEL_HIST_DOESNT_MATCH_NODES",
+    TREE_VERIFY_DEEP,
     (_TREE_PTR &&
-    !verify_check_nodes_data_pointer(_TREE_PTR))
+    !_SCAN.level_hist_matches)
 )
 
 
 //UNDEF DSL
+#undef _SCAN
 #undef _TREE_PTR
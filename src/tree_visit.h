@@ -0,0 +1,362 @@
+#ifndef TREE_VISIT_H
+#define TREE_VISIT_H
+
+#include "tree.h"
+#include "tree_par.h"
+
+#include <atomic>
+#include <new>
+#include <utility>
+
+/*
+    Whole-tree passes with the per-node work known at compile time. Functors
+    are template parameters, so calls to them are inlined into the traversal loop.
+    Traversals use parent links (see tree_iter.h) and don't allocate memory per node.
+*/
+
+//! @brief Calls 'func( TreeNode *node )' for every node of 'subtree' in given order.
+//! @note Next node is found before 'func' is called, so in TREE_ITER_POSTORDER
+//! 'func' may delete the node it is given.
+template <TreeIterOrder order, typename Func>
+inline void tree_visit( TreeNode *subtree, Func &&func )
+{
+    static_assert( order != TREE_ITER_LEVEL_ORDER, "level order needs a queue, use TreeIter" );
+
+    if (!subtree)
+        return;
+
+    TreeNode *curr = NULL;
+    if constexpr ( order == TREE_ITER_PREORDER )
+        curr = subtree;
+    else if constexpr ( order == TREE_ITER_INORDER )
+        curr = tree_inorder_first( subtree );
+    else
+        curr = tree_postorder_first( subtree );
+
+    while (curr)
+    {
+        TreeNode *next = NULL;
+        if constexpr ( order == TREE_ITER_PREORDER )
+            next = tree_preorder_next( curr, subtree );
+        else if constexpr ( order == TREE_ITER_INORDER )
+            next = tree_inorder_next( curr, subtree );
+        else
+            next = tree_postorder_next( curr, subtree );
+
+        func( curr );
+
+        curr = next;
+    }
+}
+
+//! @brief Placeholder for Inh or Syn of tree_fold(), if only one of them is needed.
+struct TreeFoldNone {};
+
+template <typename Inh, typename Syn>
+struct TreeFoldFrame_
+{
+    Inh inh     = {};
+    Syn left    = {};
+    Syn right   = {};
+    bool has_left   = false;
+    bool has_right  = false;
+};
+
+//! @brief Computes inherited (top-down) and synthesized (bottom-up) values of
+//! all nodes of the subtree in one pass.
+//! @param [in] root_inh Is passed as the inherited value of the parent of 'subtree'.
+//! @param [in] down 'Inh down( TreeNode *node, const Inh &parent_inh )' - computes
+//! the inherited value of the node. Is called for nodes in preorder.
+//! @param [in] up 'Syn up( TreeNode *node, const Inh &inh, const Syn *left, const Syn *right )' -
+//! computes the synthesized value of the node; 'left' and 'right' are values of its children
+//! (NULL if there is no such child, or it is not visited). Is called for nodes in postorder.
+//! @param [out] result_ptr Synthesized value of the root of the subtree is written here.
+//! @param [in] subtree Root of the subtree to fold, NULL means the root of the tree.
+//! If there is nothing to fold, '*result_ptr' is left untouched.
+//! @param [in] max_depth Nodes, which are 'max_depth' levels deeper than 'subtree',
+//! are folded as leaves (their children are not visited).
+//! @note Inh and Syn must be default constructible. Values are kept only for
+//! the nodes on the current path, in ONE array of (depth of the subtree + 1)
+//! elements, so levels of nodes must be correct.
+template <typename Inh, typename Syn, typename Down, typename Up>
+inline TreeStatus tree_fold( const Tree *tree_ptr,
+                             const Inh &root_inh,
+                             Down &&down,
+                             Up &&up,
+                             Syn *result_ptr,
+                             TreeNode *subtree = NULL,
+                             size_t max_depth = SIZE_MAX )
+{
+    assert(tree_ptr);
+    assert(result_ptr);
+
+    if (!subtree)
+        subtree = tree_ptr->root;
+    if (!subtree)
+        return TREE_STATUS_OK;
+
+    typedef TreeFoldFrame_<Inh, Syn> Frame;
+
+    size_t base_level = tree_node_level(subtree);
+    assert( tree_ptr->depth >= base_level );
+
+    if ( max_depth > tree_ptr->depth - base_level )
+        max_depth = tree_ptr->depth - base_level;
+
+    Frame *frames = new (std::nothrow) Frame[ max_depth + 1 ];
+    if (!frames)
+        return TREE_STATUS_ERROR_MEM_ALLOC;
+
+    frames[0].inh = down( subtree, root_inh );
+
+    // postorder walk, using parent links; frames[i] belongs to the node of the path at level base_level + i
+    TreeNode *stop = tree_node_parent(subtree);
+    TreeNode *prev = stop;
+    TreeNode *curr = subtree;
+    while (true)
+    {
+        size_t ind = tree_node_level(curr) - base_level;
+        Frame *frame = &frames[ind];
+
+        TreeNode *left  = NULL;
+        TreeNode *right = NULL;
+        if ( ind < max_depth )
+        {
+            left  = tree_node_left(curr);
+            right = tree_node_right(curr);
+        }
+
+        TreeNode *next = NULL;
+        if ( prev == tree_node_parent(curr) )
+        {
+            frame->has_left     = false;
+            frame->has_right    = false;
+            next = left ? left : right;
+        }
+        else if ( prev == left )
+        {
+            next = right;
+        }
+
+        if (next)
+        {
+            frames[ind + 1].inh = down( next, frame->inh );
+            prev = curr;
+            curr = next;
+            continue;
+        }
+
+        // both subtrees are already folded
+        Syn syn = up(   curr,
+                        (const Inh &) frame->inh,
+                        (const Syn *) (frame->has_left  ? &frame->left  : NULL),
+                        (const Syn *) (frame->has_right ? &frame->right : NULL) );
+
+        if ( curr == subtree )
+        {
+            *result_ptr = std::move(syn);
+            break;
+        }
+
+        Frame *parent_frame = &frames[ind - 1];
+        TreeNode *parent = tree_node_parent(curr);
+        if ( tree_node_left(parent) == curr )
+        {
+            parent_frame->left      = std::move(syn);
+            parent_frame->has_left  = true;
+        }
+        else
+        {
+            parent_frame->right     = std::move(syn);
+            parent_frame->has_right = true;
+        }
+
+        prev = curr;
+        curr = parent;
+    }
+
+    delete [] frames;
+
+    return TREE_STATUS_OK;
+}
+
+
+/*
+    Parallel folds. Nodes of the subtree, which are TREE_PAR_FOLD_EXTRA_DEPTH levels (plus
+    log2 of the number of threads) deeper than its root, split the subtree into the top part
+    and independent subtrees, which are folded by the work-stealing pool (see tree_par.h).
+    Then the top part is folded in the calling thread, taking results of the independent subtrees.
+    If there are less than two independent subtrees (for example, the tree is a chain),
+    the usual tree_fold() is done, so degenerate trees cost nothing extra.
+*/
+
+//! @brief Number of levels, added to log2(threads_count) to get the depth of the split.
+//! Gives about 2^TREE_PAR_FOLD_EXTRA_DEPTH tasks per thread on balanced trees.
+const size_t TREE_PAR_FOLD_EXTRA_DEPTH = 3;
+
+template <typename Syn, typename Up>
+struct TreeParFoldCtx_
+{
+    const Tree *tree_ptr = NULL;
+    Up *up = NULL;
+    std::atomic<int> failed{0};
+};
+
+template <typename Syn, typename Up>
+inline void tree_par_fold_run_( TreeParPool *pool, size_t, TreeParTask task )
+{
+    TreeParFoldCtx_<Syn, Up> *ctx = (TreeParFoldCtx_<Syn, Up> *) _tree_par_ctx( pool );
+
+    TreeStatus status = tree_fold(  ctx->tree_ptr,
+                                    TreeFoldNone{},
+                                    []( TreeNode *, const TreeFoldNone & ) { return TreeFoldNone{}; },
+                                    [ctx]( TreeNode *node, const TreeFoldNone &, const Syn *left, const Syn *right )
+                                    {
+                                        return (*ctx->up)( node, left, right );
+                                    },
+                                    (Syn *) task.arg,
+                                    (TreeNode *) (uintptr_t) task.node );
+    if ( status != TREE_STATUS_OK )
+    {
+        ctx->failed.store( 1, std::memory_order_relaxed );
+        _tree_par_cancel( pool );
+    }
+}
+
+//! @brief Computes synthesized (bottom-up) values of all nodes of the subtree, using
+//! up to tree_ptr->threads_count threads (see tree_set_threads_count()).
+//! @param [in] up 'Syn up( TreeNode *node, const Syn *left, const Syn *right )' -
+//! computes the value of the node from values of its children (NULL if there is
+//! no such child). Is called from different threads at the same time, so it
+//! mustn't change anything shared without synchronization.
+//! @param [out] result_ptr Value of the root of the subtree is written here.
+//! @param [in] subtree Root of the subtree to fold, NULL means the root of the tree.
+//! If there is nothing to fold, '*result_ptr' is left untouched.
+//! @note Syn must be default constructible. Result is the same as of the sequential fold.
+template <typename Syn, typename Up>
+inline TreeStatus tree_par_fold( const Tree *tree_ptr, Up &&up, Syn *result_ptr, TreeNode *subtree = NULL )
+{
+    assert(tree_ptr);
+    assert(result_ptr);
+
+    if (!subtree)
+        subtree = tree_ptr->root;
+    if (!subtree)
+        return TREE_STATUS_OK;
+
+    auto seq_up = [&up]( TreeNode *node, const TreeFoldNone &, const Syn *left, const Syn *right )
+    {
+        return up( node, left, right );
+    };
+    auto no_down = []( TreeNode *, const TreeFoldNone & ) { return TreeFoldNone{}; };
+
+    size_t split_depth = TREE_PAR_FOLD_EXTRA_DEPTH;
+    for (size_t threads = 1; threads < tree_ptr->threads_count; threads *= 2)
+        split_depth++;
+
+    // roots of the independent subtrees are the nodes, split_depth levels deeper than 'subtree'
+    size_t base_level = tree_node_level(subtree);
+    size_t tasks_count = 0;
+    if ( tree_ptr->threads_count > 1 )
+    {
+        for ( TreeNode *curr = subtree; curr; )
+        {
+            if ( tree_node_level(curr) - base_level == split_depth )
+            {
+                tasks_count++;
+                curr = tree_preorder_skip( curr, subtree );
+            }
+            else
+                curr = tree_preorder_next( curr, subtree );
+        }
+    }
+
+    if ( tasks_count < 2 )
+        return tree_fold( tree_ptr, TreeFoldNone{}, no_down, seq_up, result_ptr, subtree );
+
+    typedef typename std::remove_reference<Up>::type UpType;
+
+    Syn *results = new (std::nothrow) Syn[tasks_count];
+    TreeParTask *tasks = new (std::nothrow) TreeParTask[tasks_count];
+    if ( !results || !tasks )
+    {
+        delete [] results;
+        delete [] tasks;
+        return TREE_STATUS_ERROR_MEM_ALLOC;
+    }
+
+    size_t task_ind = 0;
+    for ( TreeNode *curr = subtree; curr; )
+    {
+        if ( tree_node_level(curr) - base_level == split_depth )
+        {
+            tasks[task_ind].node    = curr;
+            tasks[task_ind].arg     = &results[task_ind];
+            task_ind++;
+            curr = tree_preorder_skip( curr, subtree );
+        }
+        else
+            curr = tree_preorder_next( curr, subtree );
+    }
+
+    TreeParFoldCtx_<Syn, UpType> ctx = {};
+    ctx.tree_ptr    = tree_ptr;
+    ctx.up          = &up;
+
+    TreeStatus status = _tree_par_run(  tree_ptr->threads_count,
+                                        tree_par_fold_run_<Syn, UpType>,
+                                        &ctx,
+                                        tasks,
+                                        tasks_count );
+    if ( status == TREE_STATUS_OK && ctx.failed.load( std::memory_order_relaxed ) )
+        status = TREE_STATUS_ERROR_MEM_ALLOC;
+
+    delete [] tasks;
+
+    // folding the top part, taking the independent subtrees as leaves with known values
+    if ( status == TREE_STATUS_OK )
+    {
+        task_ind = 0;
+        status = tree_fold( tree_ptr, TreeFoldNone{}, no_down,
+                            [&]( TreeNode *node, const TreeFoldNone &inh, const Syn *left, const Syn *right )
+                            {
+                                if ( tree_node_level(node) - base_level == split_depth )
+                                    return std::move( results[task_ind++] );
+
+                                return seq_up( node, inh, left, right );
+                            },
+                            result_ptr, subtree, split_depth );
+    }
+
+    delete [] results;
+
+    return status;
+}
+
+//! @brief Computes 'combine' of 'map(node)' over all nodes of the subtree in inorder, using
+//! up to tree_ptr->threads_count threads. 'combine' must be associative (but not
+//! necessarily commutative): the result is the same as of the sequential left-to-right reduction.
+//! @param [in] map 'T map( TreeNode *node )'.
+//! @param [in] combine 'T combine( const T &left, const T &right )'.
+//! @note See tree_par_fold() about other parameters.
+template <typename T, typename Map, typename Combine>
+inline TreeStatus tree_par_reduce(  const Tree *tree_ptr,
+                                    Map &&map,
+                                    Combine &&combine,
+                                    T *result_ptr,
+                                    TreeNode *subtree = NULL )
+{
+    return tree_par_fold(   tree_ptr,
+                            [&map, &combine]( TreeNode *node, const T *left, const T *right )
+                            {
+                                T res = left ? combine( *left, map(node) ) : map(node);
+                                if (right)
+                                    res = combine( res, *right );
+
+                                return res;
+                            },
+                            result_ptr,
+                            subtree );
+}
+
+#endif /* TREE_VISIT_H */